@@ -1,8 +1,10 @@
 #ifdef ASIO_STANDALONE
     #include <asio.hpp>
+    #include <asio/steady_timer.hpp>
     #include <asio/system_timer.hpp>
 #else
     #include <boost/asio.hpp>
+    #include <boost/asio/steady_timer.hpp>
     #include <boost/asio/system_timer.hpp>
     namespace asio { using namespace boost::asio; }
     namespace asio { using boost::system::error_code; }
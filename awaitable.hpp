@@ -0,0 +1,161 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_AWAITABLE_HPP
+#define FIRMATA_AWAITABLE_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#if defined(__has_include)
+#  if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#    define FIRMATA_COROUTINES 1
+#  endif
+#endif
+
+#ifdef FIRMATA_COROUTINES
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/call_chain.hpp"
+#include "firmata/io_base.hpp"
+#include "firmata/types.hpp"
+
+#include <coroutine>
+#include <system_error>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// One-shot operation for use with co_await
+//
+// The operation is started when awaited. The start function installs
+// a callback (which receives the result) and returns a function
+// to remove it. If io is given and the callback isn't called within
+// the given time, co_await throws timeout_error.
+//
+template<typename T>
+class awaitable
+{
+public:
+    ////////////////////
+    using done_call = call<void(const std::error_code&, T)>;
+    using start_call = call<call<void()>(done_call)>;
+
+    explicit awaitable(start_call start, io_base* io = nullptr, const msec& time = forever) :
+        start_(std::move(start)), io_(io), time_(time)
+    { }
+    ~awaitable() { if(waiting_) cancel(); }
+
+    awaitable(const awaitable&) = delete;
+    awaitable& operator=(const awaitable&) = delete;
+
+    ////////////////////
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        handle_ = handle;
+        stop_ = start_([this](const std::error_code& ec, T value) { done(ec, std::move(value)); });
+
+        // done already?
+        if(done_) { cancel(); return false; }
+
+        if(io_ && time_ != forever)
+        {
+            timer_id_ = io_->on_timeout(time_, [this]()
+            {
+                timer_ = false;
+                done(std::make_error_code(std::errc::timed_out), T { });
+            });
+            timer_ = true;
+        }
+
+        waiting_ = true;
+        return true;
+    }
+
+    T await_resume()
+    {
+        if(ec_ == std::errc::timed_out) throw timeout_error("Read timed out");
+        if(ec_) throw std::system_error(ec_);
+        return std::move(value_);
+    }
+
+private:
+    ////////////////////
+    start_call start_;
+    call<void()> stop_;
+
+    io_base* io_;
+    msec time_;
+    cid timer_id_;
+    bool timer_ = false;
+
+    std::coroutine_handle<> handle_;
+    bool waiting_ = false, done_ = false;
+
+    std::error_code ec_;
+    T value_ { };
+
+    void done(const std::error_code& ec, T value)
+    {
+        if(done_) return;
+
+        done_ = true;
+        ec_ = ec;
+        value_ = std::move(value);
+
+        if(waiting_)
+        {
+            waiting_ = false;
+            cancel();
+            handle_.resume();
+        }
+    }
+
+    void cancel()
+    {
+        if(stop_)
+        {
+            auto stop = std::move(stop_);
+            stop_ = nullptr;
+            stop();
+        }
+        if(timer_) { io_->remove_call(timer_id_); timer_ = false; }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Coroutine return type for flows that co_await the above
+//
+// The coroutine runs right away until its first co_await, is then
+// resumed from within io_service::run() and frees itself when done.
+// Exceptions it doesn't catch propagate out of whatever resumed it
+// (eg, io_service::run()), the same way as from a plain callback.
+//
+//     firmata::task blink(firmata::pin& led) { ... co_await ... }
+//
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() noexcept { return { }; }
+        std::suspend_never initial_suspend() noexcept { return { }; }
+        std::suspend_never final_suspend() noexcept { return { }; }
+        void return_void() noexcept { }
+        void unhandled_exception() { throw; }
+    };
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
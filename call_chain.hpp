@@ -9,24 +9,192 @@
 #define FIRMATA_CALL_CHAIN_HPP
 
 ////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cstddef>
 #include <functional>
-#include <map>
+#include <new>
 #include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace firmata
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-// Alias for function
+namespace detail
+{
+
+// whether F can be called with Args and its result converted to R
+template<typename F, typename Fn, typename = void>
+struct is_callable : std::false_type { };
+
+template<typename F, typename R, typename... Args>
+struct is_callable<F, R(Args...), decltype(void(std::declval<F&>()(std::declval<Args>()...)))> :
+    std::integral_constant<bool, std::is_void<R>::value ||
+        std::is_convertible<decltype(std::declval<F&>()(std::declval<Args>()...)), R>::value
+    >
+{ };
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Function
+//
+// Works like std::function, but stores callables of up to inline_size bytes
+// (eg, lambdas capturing a few pointers or a std::bind of a member function)
+// in place without allocating.
+//
 template<typename Fn>
-using call = std::function<Fn>;
+class call;
+
+template<typename R, typename... Args>
+class call<R(Args...)>
+{
+public:
+    ////////////////////
+    static constexpr std::size_t inline_size = 48;
+
+    call() noexcept = default;
+    call(std::nullptr_t) noexcept { }
+
+    template<typename F, typename = std::enable_if_t<
+        !std::is_same<std::decay_t<F>, call>::value &&
+        detail::is_callable<std::decay_t<F>, R(Args...)>::value
+    >>
+    call(F&& fn) { assign<std::decay_t<F>>(std::forward<F>(fn), fits<std::decay_t<F>>()); }
+
+    call(const call& rhs) { if(rhs.ops_) { rhs.ops_->copy(&rhs.data_, &data_); ops_ = rhs.ops_; } }
+    call(call&& rhs) noexcept { move(rhs); }
+
+    ~call() { reset(); }
+
+    call& operator=(const call& rhs) { if(this != &rhs) call(rhs).swap(*this); return *this; }
+    call& operator=(call&& rhs) noexcept { if(this != &rhs) { reset(); move(rhs); } return *this; }
+    call& operator=(std::nullptr_t) noexcept { reset(); return *this; }
+
+    void swap(call& rhs) noexcept
+    {
+        call tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    ////////////////////
+    explicit operator bool() const noexcept { return ops_; }
+
+    R operator()(Args... args) const
+    {
+        if(!ops_) throw std::bad_function_call();
+        return ops_->invoke(&data_, std::forward<Args>(args)...);
+    }
+
+private:
+    ////////////////////
+    using storage = std::aligned_storage_t<inline_size, alignof(std::max_align_t)>;
+    mutable storage data_;
+
+    // type-erased operations for stored callable
+    struct ops
+    {
+        R (*invoke)(void*, Args&&...);
+        void (*copy)(const void*, void*);
+        void (*move)(void*, void*);
+        void (*destroy)(void*);
+    };
+    const ops* ops_ = nullptr;
+
+    // callable stored in place
+    template<typename F>
+    struct local
+    {
+        static F* get(void* p) noexcept { return static_cast<F*>(p); }
+
+        static R invoke(void* p, Args&&... args)
+        { return static_cast<R>((*get(p))(std::forward<Args>(args)...)); }
+
+        static void copy(const void* p, void* to) { new(to) F(*get(const_cast<void*>(p))); }
+        static void move(void* p, void* to) noexcept { new(to) F(std::move(*get(p))); get(p)->~F(); }
+        static void destroy(void* p) noexcept { get(p)->~F(); }
+
+        static constexpr ops table { &invoke, &copy, &move, &destroy };
+    };
+
+    // callable stored on the heap
+    template<typename F>
+    struct remote
+    {
+        static F*& get(void* p) noexcept { return *static_cast<F**>(p); }
+
+        static R invoke(void* p, Args&&... args)
+        { return static_cast<R>((*get(p))(std::forward<Args>(args)...)); }
+
+        static void copy(const void* p, void* to) { new(to) F*(new F(*get(const_cast<void*>(p)))); }
+        static void move(void* p, void* to) noexcept { new(to) F*(get(p)); }
+        static void destroy(void* p) noexcept { delete get(p); }
+
+        static constexpr ops table { &invoke, &copy, &move, &destroy };
+    };
+
+    template<typename F>
+    using fits = std::integral_constant<bool, sizeof(F) <= inline_size
+        && alignof(std::max_align_t) % alignof(F) == 0
+        && std::is_nothrow_move_constructible<F>::value
+    >;
+
+    template<typename F, typename G>
+    void assign(G&& fn, std::true_type)
+    {
+        new(&data_) F(std::forward<G>(fn));
+        ops_ = &local<F>::table;
+    }
+
+    template<typename F, typename G>
+    void assign(G&& fn, std::false_type)
+    {
+        new(&data_) F*(new F(std::forward<G>(fn)));
+        ops_ = &remote<F>::table;
+    }
+
+    void move(call& rhs) noexcept
+    {
+        if(rhs.ops_)
+        {
+            rhs.ops_->move(&rhs.data_, &data_);
+            ops_ = rhs.ops_;
+            rhs.ops_ = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if(ops_) { ops_->destroy(&data_); ops_ = nullptr; }
+    }
+};
+
+template<typename R, typename... Args>
+template<typename F>
+constexpr typename call<R(Args...)>::ops call<R(Args...)>::template local<F>::table;
+
+template<typename R, typename... Args>
+template<typename F>
+constexpr typename call<R(Args...)>::ops call<R(Args...)>::template remote<F>::table;
+
+template<typename R, typename... Args>
+inline void swap(call<R(Args...)>& lhs, call<R(Args...)>& rhs) noexcept { lhs.swap(rhs); }
 
 // Call id
 using cid = std::tuple<unsigned, unsigned>;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Chain of functions
+//
+// Functions are kept in a vector sorted by id. They may insert or erase
+// other functions (or themselves) while the chain is being called:
+// erased ones are removed after the call, and inserted ones are put aside
+// and not called until the next time.
+//
 template<typename Fn>
 struct call_chain
 {
@@ -43,26 +211,131 @@ struct call_chain
     auto insert(Fn fn)
     {
         cid id(token_, id_++);
-        chain_.emplace(id, std::move(fn));
+        add(id, std::move(fn));
         return id;
     }
 
-    bool erase(cid id) { return chain_.erase(id); }
-    void clear() { chain_.clear(); }
+    // insert with id given by caller
+    // (for functions shared between several chains)
+    void insert(cid id, Fn fn)
+    {
+        if(std::get<1>(id) >= id_) id_ = std::get<1>(id) + 1;
+        add(id, std::move(fn));
+    }
 
-    auto empty() const noexcept { return chain_.empty(); }
-    auto size() const noexcept { return chain_.size(); }
+    bool erase(cid id)
+    {
+        auto ci = find(chain_, id);
+        if(ci != chain_.end() && ci->live)
+        {
+            if(depth_) { ci->live = false; dead_ = true; }
+            else chain_.erase(ci);
+
+            --size_;
+            return true;
+        }
+
+        ci = find(added_, id);
+        if(ci != added_.end())
+        {
+            added_.erase(ci);
+
+            --size_;
+            return true;
+        }
+
+        return false;
+    }
+
+    void clear()
+    {
+        if(depth_)
+        {
+            for(auto& ce : chain_) ce.live = false;
+            dead_ = true;
+        }
+        else chain_.clear();
+
+        added_.clear();
+        size_ = 0;
+    }
+
+    auto empty() const noexcept { return !size_; }
+    auto size() const noexcept { return size_; }
 
     template<typename... Args>
     void operator()(Args&&... args)
     {
-        for(auto const& fn : chain_) fn.second(std::forward<Args>(args)...);
+        guard g(this);
+
+        // chain_ doesn't change size until we are done
+        for(std::size_t n = 0; n < chain_.size(); ++n)
+            if(chain_[n].live) chain_[n].fn(args...);
     }
 
 private:
     ////////////////////
     unsigned token_, id_;
-    std::map<cid, Fn> chain_;
+
+    struct entry { cid id; Fn fn; bool live; };
+    using iterator = typename std::vector<entry>::iterator;
+
+    std::vector<entry> chain_;
+    std::vector<entry> added_; // inserted during call
+
+    std::size_t size_ = 0;
+    unsigned depth_ = 0; // nested calls
+    bool dead_ = false; // there are erased entries
+
+    static iterator find(std::vector<entry>& v, const cid& id)
+    {
+        auto ci = std::lower_bound(v.begin(), v.end(), id,
+            [](const entry& ce, const cid& id) { return ce.id < id; }
+        );
+        return ci != v.end() && ci->id == id ? ci : v.end();
+    }
+
+    void add(const cid& id, Fn fn)
+    {
+        auto& v = depth_ ? added_ : chain_;
+        auto ci = std::lower_bound(v.begin(), v.end(), id,
+            [](const entry& ce, const cid& id) { return ce.id < id; }
+        );
+        if(ci != v.end() && ci->id == id) return;
+
+        v.insert(ci, entry { id, std::move(fn), true });
+        ++size_;
+    }
+
+    // remove erased entries and merge inserted ones
+    // when the outermost call is done
+    struct guard
+    {
+        call_chain* cc;
+        explicit guard(call_chain* cc) noexcept : cc(cc) { ++cc->depth_; }
+        ~guard()
+        {
+            if(--cc->depth_) return;
+
+            auto& chain = cc->chain_;
+            if(cc->dead_)
+            {
+                chain.erase(std::remove_if(chain.begin(), chain.end(),
+                    [](const entry& ce) { return !ce.live; }
+                ), chain.end());
+                cc->dead_ = false;
+            }
+
+            for(auto& ce : cc->added_)
+            {
+                auto ci = std::lower_bound(chain.begin(), chain.end(), ce.id,
+                    [](const entry& ce, const cid& id) { return ce.id < id; }
+                );
+                chain.insert(ci, std::move(ce));
+            }
+            cc->added_.clear();
+        }
+    };
 };
 
 ////////////////////////////////////////////////////////////////////////////////
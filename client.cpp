@@ -7,8 +7,13 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "firmata/client.hpp"
 
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace firmata
@@ -18,9 +23,12 @@ namespace firmata
 using namespace std::chrono_literals;
 
 msec client::time_ = 100ms; // default read timeout
+constexpr msec client::default_interval;
+bool client::pipelined_ = false;
 
 ////////////////////////////////////////////////////////////////////////////////
-client::client(io_base* io, bool dont_reset) : io_(io)
+client::client(io_base* io, bool dont_reset, std::string cache) :
+    io_(io), cache_(std::move(cache))
 {
     using namespace std::placeholders;
 
@@ -29,23 +37,58 @@ client::client(io_base* io, bool dont_reset) : io_(io)
     delegate_.digital_value = std::bind(&client::digital_value, this, _1, _2);
     delegate_.analog_value = std::bind(&client::analog_value, this, _1, _2);
     delegate_.pin_mode = std::bind(&client::pin_mode, this, _1, _2);
+    delegate_.io = io_;
+    delegate_.client = this;
+
+    for(std::size_t n = 0; n < port_chains_.size(); ++n)
+        port_chains_[n] = call_chain<port_call>(0x10 + n);
+    for(std::size_t n = 0; n < report_chains_.size(); ++n)
+        report_chains_[n] = call_chain<report_call>(0x20 + n);
 
     if(!dont_reset) reset_();
 
-    query_version();
-    query_firmware();
+    // query capability along with version and firmware,
+    // unless it is likely to come from the cache
+    if(pipelined_) query_all(cache_.empty() || !std::ifstream(cache_));
+    else
+    {
+        query_version();
+        query_firmware();
+    }
 
-    query_capability();
-    query_analog_mapping();
-    query_state();
+    // capability and analog mapping never change for given firmware,
+    // and pin state is preserved, if the board wasn't reset
+    bool pins, state;
+    std::tie(pins, state) = load_cache(dont_reset);
+
+    if(!pins && !pins_.count())
+    {
+        query_capability();
+        query_analog_mapping();
+    }
+    pins_.index();
+    if(!state) query_state();
 
     set_report();
 
-    id_ = io_->on_read(std::bind(&client::async_read, this, _1, _2));
+    // save without state, so it won't be used
+    // if we don't exit cleanly
+    save_cache(false);
+
+    subscribe();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-client::~client() noexcept { if(io_) io_->remove_call(id_); }
+client::~client() noexcept
+{
+    if(io_)
+    {
+        try { save_cache(true); } catch(...) { }
+        unsubscribe();
+        if(timer_) io_->remove_call(timer_id_);
+        if(sampling_) io_->remove_call(sampling_id_);
+    }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 void client::swap(client& rhs) noexcept
@@ -53,18 +96,23 @@ void client::swap(client& rhs) noexcept
     using namespace std::placeholders;
     using std::swap;
 
+    // deadline timers are bound to this; re-armed below
+    if(timer_) { io_->remove_call(timer_id_); timer_ = false; }
+    if(rhs.timer_) { rhs.io_->remove_call(rhs.timer_id_); rhs.timer_ = false; }
+    if(sampling_) { io_->remove_call(sampling_id_); sampling_ = false; }
+    if(rhs.sampling_) { rhs.io_->remove_call(rhs.sampling_id_); rhs.sampling_ = false; }
+
+    // read callbacks are bound to this; re-installed below
+    if(io_) unsubscribe();
+    if(rhs.io_) rhs.unsubscribe();
+
     swap(io_, rhs.io_);
-    swap(id_, rhs.id_);
-    if(io_)
-    {
-        io_->remove_call(id_);
-        id_ = io_->on_read(std::bind(&client::async_read, this, _1, _2));
-    }
-    if(rhs.io_)
-    {
-        rhs.io_->remove_call(rhs.id_);
-        rhs.id_ = rhs.io_->on_read(std::bind(&client::async_read, &rhs, _1, _2));
-    }
+    delegate_.io = io_;
+    rhs.delegate_.io = rhs.io_;
+    delegate_.client = io_ ? this : nullptr;
+    rhs.delegate_.client = rhs.io_ ? &rhs : nullptr;
+    if(io_) subscribe();
+    if(rhs.io_) rhs.subscribe();
     swap(protocol_, rhs.protocol_);
     swap(firmware_, rhs.firmware_);
     swap(pins_    , rhs.pins_    );
@@ -72,7 +120,27 @@ void client::swap(client& rhs) noexcept
     for(auto& pin: rhs.pins_) pin.delegate_ = &rhs.delegate_;
     swap(string_  , rhs.string_  );
     swap(chain_   , rhs.chain_   );
+    swap(cache_   , rhs.cache_   );
+    swap(requests_, rhs.requests_);
+    swap(request_id_, rhs.request_id_);
+    if(io_) sched_expire();
+    if(rhs.io_) rhs.sched_expire();
     swap(ports_   , rhs.ports_   );
+    swap(port_values_, rhs.port_values_);
+    swap(port_chains_, rhs.port_chains_);
+    swap(report_chains_, rhs.report_chains_);
+    swap(samples_, rhs.samples_);
+    swap(filters_, rhs.filters_);
+    swap(batch_, rhs.batch_);
+    swap(dirty_, rhs.dirty_);
+    swap(interval_, rhs.interval_);
+    swap(adaptive_, rhs.adaptive_);
+    swap(baud_, rhs.baud_);
+    swap(min_interval_, rhs.min_interval_);
+    swap(max_interval_, rhs.max_interval_);
+    swap(report_bytes_, rhs.report_bytes_);
+    if(adaptive_) sched_adapt();
+    if(rhs.adaptive_) rhs.sched_adapt();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -81,10 +149,94 @@ void client::reset()
     if(!io_) throw std::logic_error("Invalid state");
 
     reset_();
+    if(interval_ != default_interval) send_interval();
+
     query_state();
     set_report();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void client::sampling_interval(const msec& time)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    if(time.count() < 0 || time.count() > 0x3fff) throw std::invalid_argument("Invalid interval");
+
+    if(adaptive_)
+    {
+        adaptive_ = false;
+        if(sampling_) { io_->remove_call(sampling_id_); sampling_ = false; }
+    }
+
+    interval_ = time;
+    send_interval();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::send_interval()
+{
+    auto n = interval_.count();
+    io_->write(sample_rate, { byte(n & 0x7f), byte((n >> 7) & 0x7f) });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::adaptive_sampling(unsigned baud, const msec& min, const msec& max)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    if(!baud || min.count() < 1 || max < min || max.count() > 0x3fff)
+        throw std::invalid_argument("Invalid argument");
+
+    adaptive_ = true;
+    baud_ = baud;
+    min_interval_ = min;
+    max_interval_ = max;
+    report_bytes_ = 0;
+
+    // start within limits
+    auto time = std::min(std::max(interval_, min), max);
+    if(time != interval_) { interval_ = time; send_interval(); }
+
+    if(!sampling_) sched_adapt();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::sched_adapt()
+{
+    sampling_ = true;
+    sampling_id_ = io_->on_timeout(1s, std::bind(&client::adapt, this));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::adapt()
+{
+    sampling_ = false;
+    if(!adaptive_) return;
+
+    // link capacity we aim for (bits/s), with 10 bits per byte on the wire
+    // and each enabled analog input sending one 3-byte message per interval
+    double budget = baud_ / 2.0;
+    double measured = report_bytes_ * 10.0;
+    report_bytes_ = 0;
+
+    std::size_t inputs = 0;
+    for(auto& pin : pins_)
+        if(pin.mode() == analog_in && pin.analog() < analog_count) ++inputs;
+
+    // shortest interval that the analog inputs alone would fit into
+    double shortest = inputs * 30 * 1000.0 / budget;
+
+    // measured load is proportional to sampling rate,
+    // so scale interval by load / budget (with gain of 1/2)
+    double time = interval_.count();
+    double target = measured > 0 ? time * measured / budget : shortest;
+    target = std::max(target, shortest);
+    time += (target - time) / 2;
+
+    auto next = std::min(std::max(msec(static_cast<msec::rep>(time + 0.5)), min_interval_), max_interval_);
+    if(next != interval_) { interval_ = next; send_interval(); }
+
+    sched_adapt();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void client::report_digital(firmata::pos pos, bool value)
 {
@@ -96,6 +248,8 @@ void client::report_digital(firmata::pos pos, bool value)
         ports_[port].set(bit, value);
         bool now = ports_[port].any();
 
+        if(value) sync_port(pos);
+
         auto id = static_cast<msg_id>(report_port_base + port);
 
         if(before && !now) io_->write(id, { false });
@@ -103,6 +257,18 @@ void client::report_digital(firmata::pos pos, bool value)
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void client::sync_port(firmata::pos pos)
+{
+    // so that next report is compared against current state
+    std::size_t port = pos / 8, bit = pos % 8;
+    if(port < port_values_.size() && pos < pins_.count())
+    {
+        if(pins_.get(pos).state()) port_values_[port] |= 1 << bit;
+        else port_values_[port] &= ~(1 << bit);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void client::report_analog(firmata::pos pos, bool value)
 {
@@ -116,7 +282,8 @@ void client::report_analog(firmata::pos pos, bool value)
 ////////////////////////////////////////////////////////////////////////////////
 void client::digital_value(firmata::pos pos, bool value)
 {
-    io_->write(firmata::digital_value, { pos, value });
+    if(batch_) dirty_.set(pos / 8);
+    else io_->write(firmata::digital_value, { pos, value });
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -148,8 +315,12 @@ void client::string(const std::string& s)
 void client::query_version()
 {
     io_->write(version);
-    auto data = wait_until(version);
+    parse_version(wait_until(version));
+}
 
+////////////////////////////////////////////////////////////////////////////////
+void client::parse_version(payload_view data)
+{
     if(data.size() == 2)
     {
         protocol_.major = data[0];
@@ -161,22 +332,43 @@ void client::query_version()
 void client::query_firmware()
 {
     io_->write(firmware_query);
-    auto data = wait_until(firmware_response);
+    parse_firmware(wait_until(firmware_response));
+}
 
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+auto to_firmware(payload_view data)
+{
+    firmata::firmware firmware { 0, 0, { } };
     if(data.size() >= 2)
     {
-        firmware_.major = data[0];
-        firmware_.minor = data[1];
-        firmware_.name = to_string(data.begin() + 2, data.end());
+        firmware.major = data[0];
+        firmware.minor = data[1];
+        firmware.name = to_string(data.begin() + 2, data.end());
     }
+    return firmware;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::parse_firmware(payload_view data)
+{
+    if(data.size() >= 2) firmware_ = to_firmware(data);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void client::query_capability()
 {
     io_->write(capability_query);
-    auto data = wait_until(capability_response);
+    parse_capability(wait_until(capability_response));
+}
 
+////////////////////////////////////////////////////////////////////////////////
+void client::parse_capability(payload_view data)
+{
     firmata::pos pos = 0;
     firmata::pin pin(pos, &delegate_);
 
@@ -193,8 +385,7 @@ void client::query_capability()
             auto mode = static_cast<firmata::mode>(*ci);
             auto res = static_cast<firmata::res>(*++ci);
 
-            pin.modes_.insert(mode);
-            pin.reses_.emplace(mode, res);
+            pin.add(mode, res);
         }
 }
 
@@ -202,32 +393,102 @@ void client::query_capability()
 void client::query_analog_mapping()
 {
     io_->write(analog_mapping_query);
-    auto data = wait_until(analog_mapping_response);
+    parse_analog_mapping(wait_until(analog_mapping_response));
+}
 
+////////////////////////////////////////////////////////////////////////////////
+void client::parse_analog_mapping(payload_view data)
+{
     auto pi = pins_.begin();
     for(auto ci = data.begin(); ci != data.end() && pi != pins_.end(); ++ci, ++pi)
         if(*ci != 0x7f) pi->analog_ = *ci;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void client::query_all(bool capability)
+{
+    msg_id replies[] = { version, firmware_response, capability_response, analog_mapping_response };
+    payload data[4];
+    bool done[4] = { };
+
+    int count = capability ? 4 : 2;
+
+    // send all queries in one burst
+    auto send = [&]()
+    {
+        io_->write(version);
+        io_->write(firmware_query);
+        if(capability)
+        {
+            io_->write(capability_query);
+            io_->write(analog_mapping_query);
+        }
+    };
+
+    // and match replies as they arrive
+    wait_until(send, [&](msg_id id, payload_view reply)
+    {
+        for(auto n = 0; n < count; ++n)
+            if(id == replies[n] && !done[n])
+            {
+                data[n].assign(reply.begin(), reply.end());
+                done[n] = true;
+                return true;
+            }
+        return false;
+    }, count);
+
+    parse_version(data[0]);
+    parse_firmware(data[1]);
+    if(capability)
+    {
+        parse_capability(data[2]);
+        parse_analog_mapping(data[3]);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void client::query_state()
 {
-    for(auto& pin : pins_)
+    if(pipelined_)
     {
-        io_->write(pin_state_query, { pin.pos() });
-        auto data = wait_until(pin_state_response);
+        // send all queries in one burst
+        auto send = [&]()
+            { for(auto& pin : pins_) io_->write(pin_state_query, { pin.pos() }); };
 
-        if(data.size() >= 3 && data[0] == pin.pos())
+        // and match replies to pins as they arrive
+        std::vector<bool> done(pins_.count());
+        wait_until(send, [&](msg_id id, payload_view data)
         {
-            auto mode = static_cast<firmata::mode>(data[1]);
-            auto state = to_value(data.begin() + 2, data.end());
+            if(id != pin_state_response || data.size() < 3
+            || data[0] >= done.size() || done[data[0]]) return false;
 
-            pin.mode_ = mode;
-            pin.state(state);
-        }
+            parse_state(data);
+            done[data[0]] = true;
+            return true;
+        }, done.size());
+    }
+    else for(auto& pin : pins_)
+    {
+        io_->write(pin_state_query, { pin.pos() });
+        auto data = wait_until(pin_state_response);
+
+        if(data.size() >= 3 && data[0] == pin.pos()) parse_state(data);
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void client::parse_state(payload_view data)
+{
+    auto& pin = pins_.get(data[0]);
+
+    auto mode = static_cast<firmata::mode>(data[1]);
+    auto state = to_value(data.begin() + 2, data.end());
+
+    pin.mode_ = mode;
+    pin.state(state, io_->time());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void client::set_report()
 {
@@ -255,63 +516,651 @@ void client::set_report()
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void client::async_read(msg_id id, const payload& data)
+// Cache file is a text file with the following lines:
+//
+// firmata <cache version>
+// protocol <major> <minor>
+// firmware <major> <minor> <name>
+// pin <pos> <analog> <mode> <res> <mode> <res> ...
+// ...
+// state <pos> <mode> <state>
+// ...
+//
+// It is considered stale, if protocol or firmware don't match the board.
+//
+namespace { constexpr int cache_version = 1; }
+
+////////////////////////////////////////////////////////////////////////////////
+std::tuple<bool, bool> client::load_cache(bool state)
 {
-    if(id >= port_value_base && id < port_value_end)
+    std::ifstream is(cache_);
+    if(!is) return std::make_tuple(false, false);
+
+    auto get_line = [&](const char* key)
     {
-        auto pos = 8 * static_cast<int>(id - port_value_base);
-        auto value = to_value(data);
+        std::string line, name;
+        std::getline(is, line);
+
+        std::istringstream ls(line);
+        if(!(ls >> name) || name != key) ls.setstate(std::ios::failbit);
+        return ls;
+    };
+
+    int version = 0;
+    get_line("firmata") >> version;
+    if(version != cache_version) return std::make_tuple(false, false);
+
+    firmata::protocol protocol { 0, 0 };
+    get_line("protocol") >> protocol.major >> protocol.minor;
+    if(protocol.major != protocol_.major || protocol.minor != protocol_.minor)
+        return std::make_tuple(false, false);
+
+    firmata::firmware firmware { 0, 0, { } };
+    auto ls = get_line("firmware");
+    ls >> firmware.major >> firmware.minor >> std::ws;
+    std::getline(ls, firmware.name);
+    if(firmware.major != firmware_.major || firmware.minor != firmware_.minor
+    || firmware.name != firmware_.name) return std::make_tuple(false, false);
+
+    firmata::pins pins;
+    std::vector<std::tuple<firmata::pos, firmata::mode, int>> states;
 
-        for(auto n = 0; n < 8 && pos < pins_.count(); ++n, ++pos)
+    for(std::string line; std::getline(is, line); )
+    {
+        std::istringstream ls(line);
+        std::string name;
+        int pos, n, m;
+
+        ls >> name >> pos;
+        if(!ls) return std::make_tuple(false, false);
+
+        if(name == "pin" && pos == int(pins.count()))
         {
-            auto& pin = pins_.get(pos);
-            if(pin.mode() == digital_in || pin.mode() == pullup_in)
+            firmata::pin pin(pos, &delegate_);
+
+            if(ls >> n && n != 0x7f) pin.analog_ = n;
+            while(ls >> m >> n)
             {
-                // set pin state through cmd_,
-                // since pin::state(int) is private
-                pin.state(bool(value & (1 << n)));
+                auto mode = static_cast<firmata::mode>(m);
+                pin.add(mode, static_cast<firmata::res>(n));
             }
+
+            pins.push_back(std::move(pin));
         }
+        else if(name == "state" && pos >= 0 && pos < int(pins.count()) && ls >> m >> n)
+            states.emplace_back(pos, static_cast<firmata::mode>(m), n);
+
+        else return std::make_tuple(false, false);
     }
-    else if(id >= analog_value_base && id < analog_value_end)
+    if(!pins.count()) return std::make_tuple(false, false);
+
+    pins_ = std::move(pins);
+
+    state = state && states.size() == pins_.count();
+    if(state)
+        for(auto const& ps : states)
+        {
+            auto& pin = pins_.get(std::get<0>(ps));
+            pin.mode_ = std::get<1>(ps);
+            pin.state(std::get<2>(ps), std::chrono::steady_clock::now());
+        }
+
+    return std::make_tuple(true, state);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::save_cache(bool state)
+{
+    if(cache_.empty()) return;
+
+    std::ofstream os(cache_);
+    os << "firmata " << cache_version << "\n"
+       << "protocol " << protocol_.major << " " << protocol_.minor << "\n"
+       << "firmware " << firmware_.major << " " << firmware_.minor << " " << firmware_.name << "\n";
+
+    for(auto const& pin : pins_)
     {
-        auto pos = static_cast<firmata::pos>(id - analog_value_base);
+        os << "pin " << +pin.pos() << " " << +pin.analog();
+        for(auto mode : pin.modes()) os << " " << +mode << " " << +pin.reses_[mode];
+        os << "\n";
+    }
+
+    if(state)
+        for(auto const& pin : pins_)
+            os << "state " << +pin.pos() << " " << +pin.mode() << " " << pin.state() << "\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::subscribe()
+{
+    using namespace std::placeholders;
+    auto fn = std::bind(&client::async_read, this, _1, _2);
 
-        for(auto& pin : pins_)
-            if(pin.analog() == pos)
+    ids_.push_back(io_->on_read(port_value_base, port_value_end, fn));
+    ids_.push_back(io_->on_read(analog_value_base, analog_value_end, fn));
+    ids_.push_back(io_->on_read(string_data, fn));
+
+    // async query replies
+    ids_.push_back(io_->on_read(pin_state_response, fn));
+    ids_.push_back(io_->on_read(firmware_response, fn));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::unsubscribe()
+{
+    for(auto id : ids_) io_->remove_call(id);
+    ids_.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::async_read(msg_id id, payload_view data)
+{
+    // standard report messages are 3 bytes
+    if(adaptive_ && id < analog_value_end) report_bytes_ += 3;
+
+    if(id >= port_value_base && id < port_value_end)
+    {
+        auto port = static_cast<std::size_t>(id - port_value_base);
+        auto value = static_cast<byte>(to_value(data));
+        report_chains_[port](value);
+
+        auto old_value = port_values_[port];
+        byte changed = old_value ^ value;
+        if(!changed) return;
+
+        port_values_[port] = value;
+
+        // only visit pins that changed
+        for(std::size_t n = 0, pos = 8 * port; changed && pos < pins_.count(); ++n, ++pos, changed >>= 1)
+            if(changed & 1)
             {
-                if(pin.mode() == analog_in)
+                auto& pin = pins_.get(pos);
+                if(pin.mode() == digital_in || pin.mode() == pullup_in)
                 {
                     // set pin state through cmd_,
-                    // since pin::state(int) is private
-                    pin.state(to_value(data));
+                    // since pin::state() is private
+                    pin.state(bool(value & (1 << n)), io_->time());
                 }
-                break;
             }
+
+        port_chains_[port](old_value, value);
+    }
+    else if(id >= analog_value_base && id < analog_value_end)
+    {
+        auto n = static_cast<analog>(id - analog_value_base);
+        auto pin = pins_.find(n);
+        if(pin && pin->mode() == analog_in)
+        {
+            auto value = to_value(data);
+            if(samples_[n]) samples_[n]->push(io_->time(), value);
+
+            if(filters_[n] && !apply(*filters_[n], *pin, value)) return;
+
+            // set pin state through cmd_,
+            // since pin::state() is private
+            pin->state(value, io_->time());
+        }
     }
     else if(id == string_data)
     {
         std::string s = to_string(data);
         if(string_ != s) chain_(string_ = std::move(s));
     }
+    else if(requests_.size()) reply(id, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool client::remove_call(cid id)
+{
+    auto port = std::get<0>(id) - 0x10;
+    if(port < port_chains_.size()) return port_chains_[port].erase(id);
+
+    port = std::get<0>(id) - 0x20;
+    if(port < report_chains_.size()) return report_chains_[port].erase(id);
+
+    return chain_.erase(id) || requests_.erase(id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::commit()
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    if(!batch_ || --batch_) return;
+
+    for(std::size_t port = 0; port < dirty_.size(); ++port)
+        if(dirty_[port])
+        {
+            // host sets pull-ups on inputs from their bits;
+            // keep them as they are
+            int value = 0;
+            for(std::size_t n = 0, pos = 8 * port; n < 8 && pos < pins_.count(); ++n, ++pos)
+            {
+                auto& pin = pins_.get(pos);
+                if((pin.mode() == digital_out && pin.value()) || pin.mode() == pullup_in)
+                    value |= 1 << n;
+            }
+
+            auto id = static_cast<msg_id>(port_value_base + port);
+            io_->write(id, { byte(value & 0x7f), byte(value >> 7) });
+        }
+
+    dirty_.reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+bool is_input(firmata::mode mode) { return mode == digital_in || mode == pullup_in; }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<samples> client::record(analog n, std::size_t size)
+{
+    auto& history = samples_.at(n);
+
+    if(!size) history.reset();
+    else if(!history || history->capacity() != size)
+        history = std::make_shared<samples>(size);
+
+    return history;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+client::filter& client::get_filter(analog n)
+{
+    auto& flt = filters_.at(n);
+    if(!flt) flt.reset(new filter);
+    return *flt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::smooth(analog n, smoothing type, std::size_t size)
+{
+    auto& flt = get_filter(n);
+
+    flt.smooth = size > 1 ? type : no_smoothing;
+    flt.window.assign(flt.smooth ? size : 0, 0);
+    flt.sorted.resize(flt.window.size());
+    flt.next = flt.count = 0;
+    flt.sum = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::deadband(analog n, int delta)
+{
+    if(delta < 0) throw std::invalid_argument("Invalid delta");
+    get_filter(n).delta = delta;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+firmata::pin& client::schmitt(analog n, int low, int high)
+{
+    if(low > high) throw std::invalid_argument("Invalid range");
+
+    auto& pin = pins_.get(n);
+    auto& flt = get_filter(n);
+
+    if(!flt.pin.valid())
+    {
+        // virtual pin has no delegate, so its mode and value can't be set
+        flt.pin = firmata::pin(pin.pos(), nullptr);
+        flt.pin.add(digital_in, 1_bits);
+        flt.pin.mode_ = digital_in;
+    }
+    if(!flt.trigger) flt.pin.state_ = pin.state() >= high;
+
+    flt.trigger = true;
+    flt.low = low;
+    flt.high = high;
+
+    return flt.pin;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::unfilter(analog n)
+{
+    auto& flt = filters_.at(n);
+    if(flt)
+    {
+        // reset settings, but keep trigger pin
+        smooth(n, no_smoothing, 0);
+        flt->delta = 0;
+        flt->trigger = false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool client::apply(filter& flt, const firmata::pin& pin, int& value)
+{
+    if(flt.smooth)
+    {
+        auto size = flt.window.size();
+        if(flt.count < size) ++flt.count;
+        else flt.sum -= flt.window[flt.next];
+
+        flt.sum += value;
+        flt.window[flt.next] = value;
+        flt.next = (flt.next + 1) % size;
+
+        if(flt.smooth == moving_average)
+            value = static_cast<int>(flt.sum / static_cast<long>(flt.count));
+        else
+        {
+            auto begin = flt.sorted.begin(), end = begin + flt.count;
+            std::copy(flt.window.begin(), flt.window.begin() + flt.count, begin);
+
+            std::nth_element(begin, begin + flt.count / 2, end);
+            value = begin[flt.count / 2];
+        }
+    }
+
+    if(flt.trigger)
+    {
+        if(!flt.pin.state() && value >= flt.high) flt.pin.state(1, io_->time());
+        else if(flt.pin.state() && value <= flt.low) flt.pin.state(0, io_->time());
+    }
+
+    return std::abs(value - pin.state()) > flt.delta;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::configure(const std::map<firmata::pos, firmata::mode>& modes)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+
+    // check everything before sending anything
+    for(auto const& pm : modes)
+        if(!pins_.get(pm.first).supports(pm.second))
+            throw std::invalid_argument("Unsupported mode");
+
+    auto ports = ports_;
+    std::vector<firmata::pos> analog_off, analog_on;
+    std::vector<std::tuple<firmata::pin*, firmata::mode>> changed;
+
+    for(auto const& pm : modes)
+    {
+        auto& pin = pins_.get(pm.first);
+        if(pin.mode() == pm.second) continue;
+
+        std::size_t port = pin.pos() / 8, bit = pin.pos() % 8;
+        bool digital = port < ports.size();
+
+        if(is_input(pin.mode()) && digital) ports[port].reset(bit);
+        else if(pin.mode() == analog_in) analog_off.push_back(pin.analog());
+
+        if(is_input(pm.second) && digital) ports[port].set(bit);
+        else if(pm.second == analog_in) analog_on.push_back(pin.analog());
+
+        changed.emplace_back(&pin, pm.second);
+    }
+
+    // disable reporting
+    for(std::size_t port = 0; port < ports.size(); ++port)
+        if(ports_[port].any() && !ports[port].any())
+            io_->write(static_cast<msg_id>(report_port_base + port), { false });
+
+    for(auto pos : analog_off) report_analog(pos, false);
+
+    // set new modes
+    for(auto const& pm : changed)
+    {
+        auto pin = std::get<0>(pm);
+        pin->mode_ = std::get<1>(pm);
+        pin_mode(pin->pos(), pin->mode_);
+
+        if(is_input(pin->mode_)) sync_port(pin->pos());
+    }
+
+    // enable reporting
+    for(std::size_t port = 0; port < ports.size(); ++port)
+        if(!ports_[port].any() && ports[port].any())
+            io_->write(static_cast<msg_id>(report_port_base + port), { true });
+
+    for(auto pos : analog_on) report_analog(pos, true);
+
+    ports_ = ports;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::on_port_changed(firmata::pos port, byte mask, port_call fn)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+
+    return port_chains_.at(port).insert([mask, fn](byte old_value, byte new_value)
+        { if((old_value ^ new_value) & mask) fn(old_value, new_value); }
+    );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::on_port_report(firmata::pos port, report_call fn)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    return report_chains_.at(port).insert(std::move(fn));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::query_port(firmata::pos port)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+
+    // host sends current value, when reporting is enabled
+    if(ports_.at(port).any())
+        io_->write(static_cast<msg_id>(report_port_base + port), { true });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::send(msg_id id, const payload& data)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    io_->write(id, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::on_message(msg_id id, io_base::read_call fn)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    return io_->on_read(id, std::move(fn));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::on_timeout(const msec& time, io_base::timeout_call fn)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    return io_->on_timeout(time, std::move(fn));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+time_point client::time() const
+{
+    if(!io_) throw std::logic_error("Invalid state");
+    return io_->time();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::async_query_state(firmata::pos pos, state_call fn, const msec& time)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+
+    return async_query(pin_state_query, { pos }, pin_state_response, pos, time,
+        [fn](const std::error_code& ec, payload_view data)
+        { fn(ec, ec ? 0 : to_value(data.begin() + 2, data.end())); }
+    );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::future<int> client::async_query_state(firmata::pos pos, const msec& time)
+{
+    auto promise = std::make_shared<std::promise<int>>();
+    auto future = promise->get_future();
+
+    async_query_state(pos, [promise](const std::error_code& ec, int state)
+    {
+        if(ec) promise->set_exception(std::make_exception_ptr(timeout_error("Read timed out")));
+        else promise->set_value(state);
+    }, time);
+
+    return future;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::async_query_firmware(firmware_call fn, const msec& time)
+{
+    if(!io_) throw std::logic_error("Invalid state");
+
+    return async_query(firmware_query, { }, firmware_response, npos, time,
+        [fn](const std::error_code& ec, payload_view data)
+        { fn(ec, to_firmware(ec ? payload_view() : data)); }
+    );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::future<firmata::firmware> client::async_query_firmware(const msec& time)
+{
+    auto promise = std::make_shared<std::promise<firmata::firmware>>();
+    auto future = promise->get_future();
+
+    async_query_firmware([promise](const std::error_code& ec, const firmata::firmware& firmware)
+    {
+        if(ec) promise->set_exception(std::make_exception_ptr(timeout_error("Read timed out")));
+        else promise->set_value(firmware);
+    }, time);
+
+    return future;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid client::async_query(msg_id id, const payload& data, msg_id reply, firmata::pos pos, const msec& time, reply_call fn)
+{
+    cid rid(1, request_id_++); // token 1 to tell apart from string callbacks
+
+    auto deadline = time == forever ? time_point::max()
+        : std::chrono::steady_clock::now() + time;
+    requests_.emplace(rid, request { reply, pos, deadline, std::move(fn) });
+
+    io_->write(id, data);
+
+    sched_expire();
+    return rid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool client::reply(msg_id id, payload_view data)
+{
+    // replies come in the same order as queries,
+    // so pick the oldest matching request
+    auto ri = std::find_if(requests_.begin(), requests_.end(), [&](auto const& rq)
+    {
+        return rq.second.id == id && (rq.second.pos == npos
+            || (data.size() && data[0] == rq.second.pos));
+    });
+    if(ri == requests_.end()) return false;
+
+    // update pin or firmware
+    if(id == pin_state_response)
+    {
+        if(data.size() < 3 || data[0] >= pins_.count()) return false;
+        parse_state(data);
+    }
+    else if(id == firmware_response) parse_firmware(data);
+
+    auto fn = std::move(ri->second.fn);
+    requests_.erase(ri);
+
+    fn(std::error_code(), data);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::expire()
+{
+    timer_ = false;
+
+    auto now = std::chrono::steady_clock::now();
+    std::vector<reply_call> expired;
+
+    for(auto ri = requests_.begin(); ri != requests_.end(); )
+        if(ri->second.deadline <= now)
+        {
+            expired.push_back(std::move(ri->second.fn));
+            ri = requests_.erase(ri);
+        }
+        else ++ri;
+
+    sched_expire();
+
+    auto ec = std::make_error_code(std::errc::timed_out);
+    for(auto& fn : expired) fn(ec, payload_view());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::sched_expire()
+{
+    auto ri = std::min_element(requests_.begin(), requests_.end(),
+        [](auto const& x, auto const& y){ return x.second.deadline < y.second.deadline; }
+    );
+    if(ri == requests_.end() || ri->second.deadline == time_point::max()) return;
+
+    // timer is already armed for earlier deadline
+    auto deadline = ri->second.deadline;
+    if(timer_ && timer_deadline_ <= deadline) return;
+
+    if(timer_) io_->remove_call(timer_id_);
+
+    using namespace std::chrono;
+    auto time = duration_cast<msec>(deadline - steady_clock::now()) + msec(1);
+
+    timer_ = true;
+    timer_deadline_ = deadline;
+    timer_id_ = io_->on_timeout(std::max(time, msec(0)), std::bind(&client::expire, this));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 payload client::wait_until(msg_id reply_id)
 {
     payload reply_data;
-    auto id = io_->on_read([&](msg_id id, const payload& data)
-        { if(id == reply_id) reply_data = data; }
+    bool done = false;
+
+    auto id = io_->on_read(reply_id, [&](msg_id, payload_view data)
+    {
+        if(done) return;
+
+        reply_data.assign(data.begin(), data.end());
+        done = true;
+    });
+
+    auto value = io_->wait_until([&](){ return done; }, time_);
+    io_->remove_call(id);
+
+    if(!value) throw timeout_error("Read timed out");
+    return reply_data;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void client::wait_until(const call<void()>& send, const match_call& match, std::size_t count)
+{
+    std::size_t matched = 0;
+    auto id = io_->on_read([&](msg_id id, payload_view data)
+        { if(matched < count && match(id, data)) ++matched; }
     );
 
-    if(!io_->wait_until([&](){ return reply_data.size(); }, time_))
+    // writes can block and read replies
+    try { send(); }
+    catch(...) { io_->remove_call(id); throw; }
+
+    // restart timeout after each matching message
+    while(matched < count)
     {
-        io_->remove_call(id);
-        throw timeout_error("Read timed out");
+        auto before = matched;
+        if(!io_->wait_until([&](){ return matched != before; }, time_))
+        {
+            io_->remove_call(id);
+            throw timeout_error("Read timed out");
+        }
     }
 
     io_->remove_call(id);
-    return reply_data;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
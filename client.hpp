@@ -9,27 +9,41 @@
 #define FIRMATA_CLIENT_HPP
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "firmata/awaitable.hpp"
 #include "firmata/call_chain.hpp"
 #include "firmata/io_base.hpp"
 #include "firmata/pins.hpp"
+#include "firmata/samples.hpp"
 #include "firmata/types.hpp"
 
 #include <algorithm>
 #include <array>
 #include <bitset>
 #include <chrono>
+#include <future>
+#include <map>
+#include <memory>
 #include <string>
 #include <stdexcept>
+#include <system_error>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace firmata
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-struct timeout_error : public std::runtime_error { using std::runtime_error::runtime_error; };
+namespace literals
+{
+
+enum dont_reset_t { dont_reset };
+
+// analog smoothing
+enum smoothing { no_smoothing, moving_average, moving_median };
 
-namespace literals { enum dont_reset_t { dont_reset }; }
+}
 using namespace literals;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,6 +54,12 @@ public:
     client() = default;
     explicit client(io_base& io) : client(&io, false) { }
     client(io_base& io, dont_reset_t) : client(&io, true) { }
+
+    // keep board capability (and pin state, if not reset)
+    // in cache file to speed up next start
+    client(io_base& io, const std::string& cache) : client(&io, false, cache) { }
+    client(io_base& io, dont_reset_t, const std::string& cache) : client(&io, true, cache) { }
+
     ~client() noexcept;
 
     client(const client&) = delete;
@@ -63,6 +83,20 @@ public:
     // reset host
     void reset();
 
+    ////////////////////
+    // set analog (and i2c) sampling interval; disables adaptive sampling
+    template<typename Rep, typename Period>
+    void sampling_interval(const std::chrono::duration<Rep, Period>&);
+    void sampling_interval(const msec&);
+
+    // current sampling interval
+    auto const& sampling_interval() const noexcept { return interval_; }
+
+    // adjust sampling interval once a second within [min, max], so that
+    // reports take up about half of the link with given baud rate
+    void adaptive_sampling(unsigned baud, const msec& min, const msec& max);
+    auto adaptive_sampling() const noexcept { return adaptive_; }
+
     // set new read timeout
     template<typename Rep, typename Period>
     static void timeout(const std::chrono::duration<Rep, Period>&);
@@ -71,6 +105,11 @@ public:
     // current read timeout
     static auto const& timeout() noexcept { return time_; }
 
+    // enable/disable pipelined startup, where all queries
+    // are sent in one burst and replies are matched as they arrive
+    static void pipelined(bool value) noexcept { pipelined_ = value; }
+    static auto pipelined() noexcept { return pipelined_; }
+
     ////////////////////
     // send string to host
     void string(const std::string& s);
@@ -83,8 +122,92 @@ public:
     // install string changed callback
     cid on_string_changed(string_call fn) { return chain_.insert(std::move(fn)); }
 
-    // remove callback
-    bool remove_call(cid id) { return chain_.erase(id); }
+    ////////////////////
+    // last value received for digital port (pins 8*port to 8*port+7)
+    auto port_value(pos port) const { return port_values_.at(port); }
+
+    using port_call = call<void(byte old_value, byte new_value)>;
+
+    // install port changed callback, which is called
+    // when any of the bits in mask change
+    cid on_port_changed(pos port, byte mask, port_call);
+
+    using report_call = call<void(byte value)>;
+
+    // install port report callback, which is called with raw value
+    // of every report received (whether it changed or not)
+    cid on_port_report(pos port, report_call);
+
+    // ask host to report port again (if it is being reported)
+    void query_port(pos port);
+
+    ////////////////////
+    // Digital output batch: values set between batch() and commit()
+    // are sent as one port message per touched port, so that they change
+    // at the same time. Batches can be nested; outermost commit sends.
+    void batch() noexcept { ++batch_; }
+    void commit();
+
+    // batch that is committed when going out of scope
+    // (even if an exception is thrown)
+    class batch_scope
+    {
+    public:
+        explicit batch_scope(client& c) noexcept : client_(c) { client_.batch(); }
+        ~batch_scope() { if(!done_) try { client_.commit(); } catch(...) { } }
+
+        batch_scope(const batch_scope&) = delete;
+        batch_scope& operator=(const batch_scope&) = delete;
+
+        // commit now (may throw)
+        void commit() { done_ = true; client_.commit(); }
+
+    private:
+        client& client_;
+        bool done_ = false;
+    };
+
+    ////////////////////
+    // set modes of several pins at once, sending only the pin_mode
+    // and report messages needed to get there: reporting is disabled
+    // first, then modes are set, and then reporting is enabled
+    void configure(const std::map<pos, mode>&);
+
+    ////////////////////
+    // remove callback (or cancel query)
+    bool remove_call(cid);
+
+    ////////////////////
+    // Async queries don't block and can be issued while others are
+    // in flight; replies are matched to them by message id and pin.
+    //
+    // Callbacks are called with the result or with errc::timed_out,
+    // if the reply didn't arrive within the given time. Future variants
+    // throw timeout_error instead; they are only ready once the io_service
+    // has processed the reply.
+    //
+    using state_call = call<void(const std::error_code&, int)>;
+    using firmware_call = call<void(const std::error_code&, const firmata::firmware&)>;
+
+    // query pin state
+    cid async_query_state(pos, state_call, const msec& = time_);
+    std::future<int> async_query_state(pos, const msec& = time_);
+
+    // query firmware name & version
+    cid async_query_firmware(firmware_call, const msec& = time_);
+    std::future<firmata::firmware> async_query_firmware(const msec& = time_);
+
+#ifdef FIRMATA_COROUTINES
+    // query pin state: int state = co_await client.query_state(pos);
+    awaitable<int> query_state(firmata::pos pos, const msec& time = time_)
+    {
+        return awaitable<int>([this, pos, time](state_call fn) -> call<void()>
+        {
+            auto id = async_query_state(pos, std::move(fn), time);
+            return [this, id]() { remove_call(id); };
+        });
+    }
+#endif
 
     ////////////////////
     // get all pins (for use in range-based "for" loops)
@@ -103,16 +226,62 @@ public:
     auto& pin(mode m, pos n) { return pins_.get(m, n); }
     auto const& pin(mode m, pos n) const { return pins_.get(m, n); }
 
+    ////////////////////
+    // keep history of last n samples of analog pin
+    // (or stop, if n is 0) and return it
+    std::shared_ptr<samples> record(analog, std::size_t n);
+
+    // history of analog pin (nullptr if not recording)
+    auto history(analog n) const { return samples_.at(n); }
+
+    ////////////////////
+    // Analog filters are applied to reports before pin state changes,
+    // in this order: smoothing, Schmitt trigger and deadband.
+
+    // smooth values over last n samples
+    void smooth(analog, smoothing, std::size_t n);
+
+    // ignore changes of delta or less
+    void deadband(analog, int delta);
+
+    // get virtual digital pin driven by the analog pin, which goes high
+    // when value rises to high and low when it falls to low; the pin
+    // (and its callbacks) stays put for the lifetime of the client
+    firmata::pin& schmitt(analog, int low, int high);
+
+    // remove all filters (virtual pin stops changing)
+    void unfilter(analog);
+
+    ////////////////////
+    // Raw messages and timers for board features implemented outside
+    // of client (eg, hw_encoder and i2c_bus). They throw logic_error,
+    // if the client has no io.
+
+    // send message to host
+    void send(msg_id, const payload& = { });
+
+    // install read callback for message id
+    cid on_message(msg_id, io_base::read_call);
+
+    // install callback to be called once after timeout
+    cid on_timeout(const msec&, io_base::timeout_call);
+
+    // remove message or timeout callback
+    bool remove_io_call(cid id) { return io_ && io_->remove_call(id); }
+
+    // receive time of message being handled
+    time_point time() const;
+
     ////////////////////
     // print out host info (for debugging only)
     void info();
 
 private:
     ////////////////////
-    client(io_base*, bool dont_reset);
+    client(io_base*, bool dont_reset, std::string cache = { });
 
     io_base* io_ = nullptr;
-    cid id_;
+    std::vector<cid> ids_; // read callbacks
 
     firmata::protocol protocol_ { 0, 0 };
     firmata::firmware firmware_ { 0, 0 };
@@ -123,11 +292,16 @@ private:
     std::string string_;
     call_chain<string_call> chain_;
 
+    std::string cache_; // cache file path
+
     static msec time_;
+    static bool pipelined_;
 
     ////////////////////
     // enable/disable reporting for a digital pin
     void report_digital(pos, bool);
+    // resync last port value with pin state
+    void sync_port(pos);
     // enable/disable reporting for an analog pin
     void report_analog(pos, bool);
 
@@ -144,28 +318,136 @@ private:
 
     // query protocol version
     void query_version();
+    void parse_version(payload_view);
     // query firmware name & version
     void query_firmware();
+    void parse_firmware(payload_view);
     // query capability (pins, modes and reses)
     void query_capability();
+    void parse_capability(payload_view);
     // query analog pin mapping
     void query_analog_mapping();
+    void parse_analog_mapping(payload_view);
+    // query all of the above (except capability & analog mapping,
+    // if they are to be loaded from cache) in one go
+    void query_all(bool capability);
     // query current pin state
     void query_state();
+    void parse_state(payload_view);
 
     // enable reporting for all inputs
     // and disable for all outputs
     void set_report();
 
+    // load pins (and their state) from cache;
+    // return whether pins and state were loaded
+    std::tuple<bool, bool> load_cache(bool state);
+    // save pins (and their state) to cache
+    void save_cache(bool state);
+
+    // install/remove read callbacks for messages we handle
+    void subscribe();
+    void unsubscribe();
+
     // read messages from host
-    void async_read(msg_id, const payload&);
+    void async_read(msg_id, payload_view);
 
     ////////////////////
     // ports that are currently being monitored
     std::array<std::bitset<8>, port_count> ports_;
 
+    // last port values and port changed call chains
+    // (with token 0x10 + port)
+    std::array<byte, port_count> port_values_ { };
+    std::array<call_chain<port_call>, port_count> port_chains_;
+
+    // port report call chains (with token 0x20 + port)
+    std::array<call_chain<report_call>, port_count> report_chains_;
+
+    // analog pin histories
+    std::array<std::shared_ptr<samples>, analog_count> samples_;
+
+    // analog filter settings and state
+    struct filter
+    {
+        smoothing smooth = no_smoothing;
+        std::vector<int> window, sorted; // last n samples
+        std::size_t next = 0, count = 0;
+        long sum = 0;
+
+        int delta = 0;
+
+        bool trigger = false; int low = 0, high = 0;
+        firmata::pin pin; // virtual trigger pin
+    };
+    // allocated on first use and kept, since trigger pin is handed out
+    std::array<std::unique_ptr<filter>, analog_count> filters_;
+
+    filter& get_filter(analog);
+
+    // apply filter to new value of pin;
+    // return false, if it should be dropped
+    bool apply(filter&, const firmata::pin&, int& value);
+
+    // batch nesting level and ports with pending values
+    unsigned batch_ = 0;
+    std::bitset<port_count> dirty_;
+
+    ////////////////////
+    using reply_call = call<void(const std::error_code&, payload_view)>;
+
+    // query in flight
+    struct request
+    {
+        msg_id id; firmata::pos pos; // expected reply id and pin (if any)
+        time_point deadline;
+        reply_call fn;
+    };
+    std::map<cid, request> requests_;
+    unsigned request_id_ = 0;
+
+    ////////////////////
+    static constexpr msec default_interval { 19 }; // host default
+
+    msec interval_ = default_interval;
+    void send_interval();
+
+    // adaptive sampling settings and report bytes received
+    // in the current period
+    bool adaptive_ = false;
+    unsigned baud_ = 0;
+    msec min_interval_, max_interval_;
+    std::size_t report_bytes_ = 0;
+
+    // sampling timer
+    cid sampling_id_; bool sampling_ = false;
+
+    // adjust sampling interval to measured load
+    void adapt();
+    void sched_adapt();
+
+    ////////////////////
+    // deadline timer (for the earliest request)
+    cid timer_id_; bool timer_ = false; time_point timer_deadline_;
+
+    // send query and add request
+    cid async_query(msg_id, const payload&, msg_id reply, pos, const msec&, reply_call);
+    // match reply to request in flight
+    bool reply(msg_id, payload_view);
+
+    // expire requests past their deadline
+    void expire();
+    // re-arm deadline timer
+    void sched_expire();
+
     // wait for specific message
     payload wait_until(msg_id);
+
+    using match_call = call<bool(msg_id, payload_view)>;
+
+    // send queries and wait for count replies accepted by match
+    // (match is installed first, so that no reply is missed)
+    void wait_until(const call<void()>& send, const match_call&, std::size_t count);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -174,6 +456,12 @@ inline void
 client::timeout(const std::chrono::duration<Rep, Period>& time)
 { timeout(std::chrono::duration_cast<msec>(time)); }
 
+////////////////////////////////////////////////////////////////////////////////
+template<typename Rep, typename Period>
+inline void
+client::sampling_interval(const std::chrono::duration<Rep, Period>& time)
+{ sampling_interval(std::chrono::duration_cast<msec>(time)); }
+
 ////////////////////////////////////////////////////////////////////////////////
 inline void swap(client& lhs, client& rhs) noexcept { lhs.swap(rhs); }
 
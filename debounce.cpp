@@ -8,6 +8,7 @@
 #include "debounce.hpp"
 
 #include <functional>
+#include <mutex>
 #include <stdexcept>
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -21,7 +22,7 @@ cid debounce::on_state_changed(firmata::pin& pin, pin::int_call fn)
 
     cid id(0, id_++);
     chain_.emplace(id, std::unique_ptr<bounce>
-        { new bounce(*io_, time_, pin, std::move(fn)) }
+        { new bounce(*driver_, time_, pin, std::move(fn), last_.get()) }
     );
     return id;
 }
@@ -39,8 +40,73 @@ cid debounce::on_state_high(firmata::pin& pin, pin::void_call fn)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-debounce::bounce::bounce(asio::io_service& io, const msec& time, firmata::pin& pin, pin::int_call fn) :
-    pin_(pin), state_(pin_.state()), time_(time), timer_(io), fn_(std::move(fn))
+debounce::driver::driver(asio::io_service& io) :
+    timer(io), start(std::chrono::steady_clock::now())
+{ }
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<debounce::driver> debounce::driver::get(asio::io_service& io)
+{
+    static std::mutex mutex;
+    static std::map<asio::io_service*, std::weak_ptr<driver>> drivers;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // forget drivers that are gone
+    for(auto di = drivers.begin(); di != drivers.end(); )
+        if(di->second.expired()) di = drivers.erase(di);
+        else ++di;
+
+    auto& weak = drivers[&io];
+    auto drv = weak.lock();
+    if(!drv) weak = drv = std::make_shared<driver>(io);
+
+    return drv;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void debounce::driver::arm(timer_wheel::node& node, const msec& time)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    // catch up, if we've been idle
+    if(wheel.empty()) wheel.advance(std::chrono::duration_cast<msec>(now - start).count());
+
+    // round up, so that we don't fire early
+    auto expiry = now + time - start;
+    auto tick = std::chrono::duration_cast<msec>(expiry).count();
+    if(msec(tick) < expiry) ++tick;
+
+    wheel.arm(node, tick);
+    sched();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void debounce::driver::sched()
+{
+    if(wheel.empty()) return;
+
+    auto next = wheel.next();
+    if(waiting && at <= next) return;
+
+    waiting = true;
+    at = next;
+
+    timer.expires_at(start + msec(next));
+    timer.async_wait([this](const asio::error_code& ec)
+    {
+        if(ec == asio::error::operation_aborted) return;
+        waiting = false;
+
+        auto now = std::chrono::steady_clock::now();
+        wheel.advance(std::chrono::duration_cast<msec>(now - start).count());
+        sched();
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+debounce::bounce::bounce(driver& drv, const msec& time, firmata::pin& pin, pin::int_call fn, time_point* last) :
+    driver_(drv), pin_(pin), state_(pin_.state()), last_(last), time_(time), next_(state_), fn_(std::move(fn))
 {
     if(pin_.mode() == digital_in || pin_.mode() == pullup_in)
     {
@@ -53,19 +119,26 @@ debounce::bounce::bounce(asio::io_service& io, const msec& time, firmata::pin& p
 ////////////////////////////////////////////////////////////////////////////////
 debounce::bounce::~bounce() noexcept
 {
-    timer_.cancel();
+    driver_.wheel.cancel(*this);
     pin_.remove_call(id_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void debounce::bounce::pin_state_changed(int state)
 {
-    timer_.expires_from_now(time_);
-    timer_.async_wait([=](const asio::error_code& ec)
+    next_ = state;
+    edge_ = pin_.time();
+    driver_.arm(*this, time_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void debounce::bounce::expired()
+{
+    if(next_ != state_)
     {
-        if(ec != asio::error::operation_aborted && state != state_)
-            fn_(state_ = state);
-    });
+        *last_ = edge_;
+        fn_(state_ = next_);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
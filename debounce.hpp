@@ -10,6 +10,7 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include "firmata/pin.hpp"
+#include "firmata/timer_wheel.hpp"
 #include "firmata/types.hpp"
 
 #include "asio_or_boost.hpp"
@@ -25,6 +26,12 @@ namespace firmata
 ////////////////////////////////////////////////////////////////////////////////
 // Pin debouncer
 //
+// Pending state changes of all pins are kept in a timer wheel driven by
+// a single asio timer, which is shared by all debouncers on the same
+// io_service. Edges re-arm their pin's wheel node in O(1) without
+// allocating; the asio timer is only re-armed, when an earlier expiry
+// comes along.
+//
 class debounce
 {
 public:
@@ -37,7 +44,7 @@ public:
     { }
 
     explicit debounce(asio::io_service& io, const msec& time = msec(5)) :
-        io_(&io), time_(time)
+        io_(&io), time_(time), driver_(driver::get(io)), last_(new time_point())
     { }
 
     debounce(const debounce&) = delete;
@@ -49,11 +56,13 @@ public:
     void swap(debounce& rhs) noexcept
     {
         using std::swap;
-        swap(io_   , rhs.io_   );
-        swap(time_ , rhs.time_ );
-        swap(chain_, rhs.chain_);
-        swap(id_   , rhs.id_   );
-   }
+        swap(io_    , rhs.io_    );
+        swap(time_  , rhs.time_  );
+        swap(driver_, rhs.driver_);
+        swap(chain_ , rhs.chain_ );
+        swap(id_    , rhs.id_    );
+        swap(last_  , rhs.last_  );
+    }
 
     ////////////////////
     bool valid() const noexcept { return io_; }
@@ -68,26 +77,61 @@ public:
     // remove callback
     bool remove_call(cid id) { return chain_.erase(id); }
 
+    // receive time of the edge that led to last reported state change
+    time_point time() const noexcept { return last_ ? *last_ : time_point(); }
+
 private:
     ////////////////////
     asio::io_service* io_ = nullptr;
     msec time_;
 
-    struct bounce
+    // timer wheel and its asio timer (one per io_service)
+    struct driver
+    {
+        explicit driver(asio::io_service&);
+
+        // get driver for io_service (creating it, if needed)
+        static std::shared_ptr<driver> get(asio::io_service&);
+
+        asio::steady_timer timer;
+        time_point start; // time of tick 0
+        timer_wheel wheel;
+
+        bool waiting = false;
+        timer_wheel::tick at = 0; // tick the timer is waiting for
+
+        // arm node to expire after given time
+        void arm(timer_wheel::node&, const msec&);
+        // (re)schedule asio timer for the next wheel tick
+        void sched();
+    };
+
+    std::shared_ptr<driver> driver_;
+
+    // receive time of the edge that led to last reported state change
+    // (shared with bounces, so that it doesn't move)
+    std::unique_ptr<time_point> last_;
+
+    struct bounce : timer_wheel::node
     {
         ////////////////////
-        bounce(asio::io_service&, const msec&, pin&, pin::int_call);
+        bounce(driver&, const msec&, pin&, pin::int_call, time_point* last);
         ~bounce() noexcept;
 
     private:
         ////////////////////
+        driver& driver_;
         pin& pin_; int state_; cid id_;
-
+        time_point* last_;
         msec time_;
-        asio::system_timer timer_;
+
+        // pending state and receive time of its edge
+        int next_; time_point edge_;
 
         pin::int_call fn_;
         void pin_state_changed(int);
+
+        void expired() override;
     };
 
     std::map<cid, std::unique_ptr<bounce>> chain_;
@@ -7,6 +7,9 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "encoder.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <functional>
 #include <stdexcept>
 #include <utility>
@@ -16,7 +19,8 @@ namespace firmata
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-encoder::encoder(pin& pin1, pin& pin2) : pin1_(&pin1), pin2_(&pin2)
+encoder::encoder(client& c, pin& pin1, pin& pin2) :
+    client_(&c), pin1_(&pin1), pin2_(&pin2)
 {
     if(pin1_->mode() != digital_in && pin1_->mode() != pullup_in)
         throw std::invalid_argument("Invalid pin1 mode");
@@ -24,36 +28,52 @@ encoder::encoder(pin& pin1, pin& pin2) : pin1_(&pin1), pin2_(&pin2)
     if(pin2_->mode() != digital_in && pin2_->mode() != pullup_in)
         throw std::invalid_argument("Invalid pin2 mode");
 
-    using namespace std::placeholders;
-    id_ = pin1_->on_state_changed(std::bind(&encoder::pin_state_changed, this, _1));
+    if(pin1_->pos() / 8 >= port_count || pin2_->pos() / 8 >= port_count)
+        throw std::invalid_argument("Invalid pin");
+
+    ab_ = state();
+    bind();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+client& encoder::owner(pin& pin1, pin& pin2)
+{
+    if(!pin1.delegate_ || !pin1.delegate_->client || pin1.delegate_ != pin2.delegate_)
+        throw std::invalid_argument("Invalid pin");
+
+    return *pin1.delegate_->client;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-encoder::~encoder() { if(pin1_) pin1_->remove_call(id_); }
+encoder::~encoder() { if(client_) unbind(); }
 
 ////////////////////////////////////////////////////////////////////////////////
 void encoder::swap(encoder& rhs) noexcept
 {
-    using namespace std::placeholders;
     using std::swap;
 
-    swap(pin1_, rhs.pin1_);
-    swap(pin2_, rhs.pin2_);
-    swap(id_  , rhs.id_  );
-    if(pin1_)
-    {
-        pin1_->remove_call(id_);
-        id_ = pin1_->on_state_changed(std::bind(&encoder::pin_state_changed, this, _1));
-    }
-    if(rhs.pin1_)
-    {
-        rhs.pin1_->remove_call(rhs.id_);
-        rhs.id_ = rhs.pin1_->on_state_changed(std::bind(&encoder::pin_state_changed, &rhs, _1));
-    }
+    swap(client_, rhs.client_);
+    swap(pin1_  , rhs.pin1_  );
+    swap(pin2_  , rhs.pin2_  );
+    swap(id1_   , rhs.id1_   );
+    swap(id2_   , rhs.id2_   );
+    if(client_) { unbind(); bind(); }
+    if(rhs.client_) { rhs.unbind(); rhs.bind(); }
+
     swap(rotate_    , rhs.rotate_    );
     swap(rotate_cw_ , rhs.rotate_cw_ );
     swap(rotate_ccw_, rhs.rotate_ccw_);
-    swap(step_      , rhs.step_      );
+    swap(ab_        , rhs.ab_        );
+    swap(position_  , rhs.position_  );
+    swap(count_     , rhs.count_     );
+    swap(time_      , rhs.time_      );
+    swap(edges_     , rhs.edges_     );
+    swap(next_      , rhs.next_      );
+    swap(edges_n_   , rhs.edges_n_   );
+    swap(dir_       , rhs.dir_       );
+    swap(run_       , rhs.run_       );
+    swap(velocity_  , rhs.velocity_  );
+    swap(accel_     , rhs.accel_     );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -67,23 +87,110 @@ bool encoder::remove_call(cid id)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void encoder::pin_state_changed(int state)
+double encoder::velocity() const noexcept
+{
+    if(!edges_n_) return 0;
+
+    auto last = edges_[(next_ + edges_.size() - 1) % edges_.size()];
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count();
+
+    // bound by 1 count over time since the last one
+    if(elapsed > 0 && std::abs(velocity_) * elapsed > 1) return dir_ / elapsed;
+    return velocity_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+double encoder::acceleration() const noexcept
+{
+    if(!edges_n_) return 0;
+
+    auto last = edges_[(next_ + edges_.size() - 1) % edges_.size()];
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count();
+
+    // slowing down, if velocity is decaying
+    if(elapsed > 0 && std::abs(velocity_) * elapsed > 1) return (dir_ / elapsed - velocity_) / elapsed;
+    return accel_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void encoder::bind()
+{
+    pos port1 = pin1_->pos() / 8, port2 = pin2_->pos() / 8;
+    byte bit1 = 1 << pin1_->pos() % 8, bit2 = 1 << pin2_->pos() % 8;
+
+    // both pins on the same port change in the same report
+    if(port1 == port2)
+        id1_ = client_->on_port_changed(port1, bit1 | bit2, std::bind(&encoder::port_changed, this));
+    else
+    {
+        id1_ = client_->on_port_changed(port1, bit1, std::bind(&encoder::port_changed, this));
+        id2_ = client_->on_port_changed(port2, bit2, std::bind(&encoder::port_changed, this));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void encoder::unbind()
+{
+    client_->remove_call(id1_);
+    if(pin1_->pos() / 8 != pin2_->pos() / 8) client_->remove_call(id2_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+unsigned encoder::state() const
+{
+    auto bit = [&](pos n) { return (client_->port_value(n / 8) >> n % 8) & 1; };
+    return bit(pin1_->pos()) << 1 | bit(pin2_->pos());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void encoder::port_changed()
 {
-    if(state)
+    auto ab = state();
+    auto step = quad_step(ab_, ab);
+    ab_ = ab;
+
+    if(!step) return;
+    position_ += step;
+
+    ////////////////////
+    auto time = client_->time();
+
+    if(step != dir_) { dir_ = step; run_ = 0; }
+    ++run_;
+
+    // measure over up to one cycle in this direction
+    // (and one count, if it just changed)
+    auto n = std::min(std::min(run_, edges_n_), edges_.size());
+    if(n)
     {
-        auto step = pin2_->state() ? cw : ccw;
-        if(step == step_)
+        auto then = edges_[(next_ + edges_.size() - n) % edges_.size()];
+        auto last = edges_[(next_ + edges_.size() - 1) % edges_.size()];
+
+        double dt = std::chrono::duration<double>(time - then).count();
+        double since = std::chrono::duration<double>(time - last).count();
+        if(dt > 0)
         {
-            switch(step)
-            {
-            case  no: break;
-            case  cw: rotate_( 1); rotate_cw_(); break;
-            case ccw: rotate_(-1); rotate_ccw_(); break;
-            }
+            double velocity = step * double(n) / dt;
+            if(since > 0) accel_ = (velocity - velocity_) / since;
+            velocity_ = velocity;
         }
-        step_ = no;
     }
-    else step_ = pin2_->state() ? ccw : cw;
+
+    edges_[next_] = time;
+    next_ = (next_ + 1) % edges_.size();
+    if(edges_n_ < edges_.size()) ++edges_n_;
+
+    ////////////////////
+    count_ += step;
+    if(count_ == 4 || count_ == -4)
+    {
+        auto cw = count_ > 0;
+        count_ = 0;
+        time_ = time;
+
+        if(cw) { rotate_( 1); rotate_cw_(); }
+        else { rotate_(-1); rotate_ccw_(); }
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
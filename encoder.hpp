@@ -9,20 +9,55 @@
 #define FIRMATA_ENCODER_HPP
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "firmata/awaitable.hpp"
 #include "firmata/call_chain.hpp"
+#include "firmata/client.hpp"
 #include "firmata/pin.hpp"
+#include "firmata/types.hpp"
+
+#include <array>
+#include <cstddef>
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace firmata
 {
 
 ////////////////////////////////////////////////////////////////////////////////
+// Quadrature decoding
+//
+// Pin states are combined into AB = pin1 << 1 | pin2. Rotating cw goes
+// through AB = 2, 0, 1, 3 and back to 2, and each transition is one count.
+//
+// return count for transition between two AB states:
+// +1 (cw), -1 (ccw) or 0 (no change or skipped state)
+constexpr int quad_step(unsigned from, unsigned to) noexcept
+{
+    // indexed by from << 2 | to
+    constexpr signed char table[16] =
+    {
+         0, +1, -1,  0,
+        -1,  0,  0, +1,
+        +1,  0,  0, -1,
+         0, -1, +1,  0,
+    };
+    return table[(from & 3) << 2 | (to & 3)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Rotary encoder
+//
+// Decodes all 4 transitions of each cycle on both pins; rotate callbacks
+// are called once per cycle (every 4 counts). AB state is taken from port
+// values, so that a report changing both pins at once is seen as a skipped
+// state rather than two counts in opposite directions.
+//
 class encoder
 {
 public:
     ////////////////////
     encoder() = default;
-    encoder(pin&, pin&);
+    encoder(pin& pin1, pin& pin2) : encoder(owner(pin1, pin2), pin1, pin2) { }
+    encoder(client&, pin&, pin&);
     ~encoder();
 
     encoder(const encoder&) = delete;
@@ -34,7 +69,7 @@ public:
     void swap(encoder&) noexcept;
 
     ////////////////////
-    bool valid() const noexcept { return pin1_; }
+    bool valid() const noexcept { return client_; }
     explicit operator bool() const noexcept { return valid(); }
 
     ////////////////////
@@ -49,18 +84,69 @@ public:
     // remove callback
     bool remove_call(cid);
 
+    // when last rotated (receive time)
+    auto const& time() const noexcept { return time_; }
+
+    ////////////////////
+    // accumulated position in counts (4 per cycle; cw is positive)
+    auto position() const noexcept { return position_; }
+
+    // Velocity is measured over last cycle (or less after change of
+    // direction). When no counts come in, it decays as 1 count over time
+    // since the last one, since it can't be any higher than that.
+    //
+    // velocity in counts per second
+    double velocity() const noexcept;
+    // acceleration in counts per second squared
+    double acceleration() const noexcept;
+
+#ifdef FIRMATA_COROUTINES
+    ////////////////////
+    // wait for next step: int step = co_await encoder.next_rotation();
+    // throws timeout_error, if there is no rotation within the given time
+    awaitable<int> next_rotation(const msec& time = forever)
+    {
+        return awaitable<int>([this](awaitable<int>::done_call fn) -> call<void()>
+        {
+            auto id = on_rotate([fn](int step) { fn(std::error_code(), step); });
+            return [this, id]() { remove_call(id); };
+        }, pin1_ && pin1_->delegate_ ? pin1_->delegate_->io : nullptr, time);
+    }
+#endif
+
 private:
     ////////////////////
-    pin* pin1_ = nullptr; pin* pin2_ = nullptr; cid id_;
+    client* client_ = nullptr;
+    static client& owner(pin&, pin&);
+
+    pin* pin1_ = nullptr; pin* pin2_ = nullptr; cid id1_, id2_;
 
     // rotate call chains
     call_chain< int_call> rotate_     { 0 };
     call_chain<void_call> rotate_cw_  { 1 };
     call_chain<void_call> rotate_ccw_ { 2 };
 
-    void pin_state_changed(int);
+    // subscribe to port changes (one or two ports)
+    void bind();
+    void unbind();
+    void port_changed();
+
+    // current AB state
+    unsigned state() const;
+
+    unsigned ab_ = 0; // last AB state
+    long position_ = 0;
+    int count_ = 0; // counts since last rotate call
+    time_point time_;
+
+    // receive times of last counts
+    std::array<time_point, 4> edges_;
+    std::size_t next_ = 0, edges_n_ = 0;
+
+    // direction and number of counts in that direction
+    int dir_ = 0; std::size_t run_ = 0;
 
-    enum { no, cw, ccw } step_ = no;
+    double velocity_ = 0, accel_ = 0;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
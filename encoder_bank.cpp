@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "encoder_bank.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+encoder_bank::~encoder_bank()
+{
+    if(client_)
+        for(std::size_t port = 0; port < masks_.size(); ++port)
+            if(masks_[port]) client_->remove_call(ids_[port]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void encoder_bank::swap(encoder_bank& rhs) noexcept
+{
+    using std::swap;
+
+    swap(client_, rhs.client_);
+    swap(encs_  , rhs.encs_  );
+    swap(ports_ , rhs.ports_ );
+    swap(masks_ , rhs.masks_ );
+    swap(ids_   , rhs.ids_   );
+    swap(rotate_, rhs.rotate_);
+
+    // port callbacks are bound to this
+    for(std::size_t port = 0; port < masks_.size(); ++port)
+    {
+        if(masks_[port])
+        {
+            client_->remove_call(ids_[port]);
+            bind(port);
+        }
+        if(rhs.masks_[port])
+        {
+            rhs.client_->remove_call(rhs.ids_[port]);
+            rhs.bind(port);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t encoder_bank::add(pin& pin1, pin& pin2)
+{
+    if(!client_) throw std::logic_error("Invalid state");
+
+    if(pin1.mode() != digital_in && pin1.mode() != pullup_in)
+        throw std::invalid_argument("Invalid pin1 mode");
+
+    if(pin2.mode() != digital_in && pin2.mode() != pullup_in)
+        throw std::invalid_argument("Invalid pin2 mode");
+
+    if(pin1.pos() / 8 >= port_count || pin2.pos() / 8 >= port_count)
+        throw std::invalid_argument("Invalid pin");
+
+    auto index = encs_.size();
+    encs_.push_back(enc { pin1.pos(), pin2.pos(), 0, 0, 0 });
+    encs_.back().ab = state(encs_.back());
+
+    for(auto n : { pin1.pos(), pin2.pos() })
+    {
+        pos port = n / 8;
+
+        auto& encs = ports_[port];
+        if(encs.empty() || encs.back() != index) encs.push_back(index);
+
+        // re-install with new mask
+        if(masks_[port]) client_->remove_call(ids_[port]);
+        masks_[port] |= 1 << (n % 8);
+        bind(port);
+    }
+
+    return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void encoder_bank::bind(pos port)
+{
+    using namespace std::placeholders;
+    ids_[port] = client_->on_port_changed(port, masks_[port],
+        std::bind(&encoder_bank::port_changed, this, port, _1, _2)
+    );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void encoder_bank::port_changed(pos port, byte old_value, byte new_value)
+{
+    byte changed = old_value ^ new_value;
+
+    // callbacks may add encoders
+    for(std::size_t n = 0; n < ports_[port].size(); ++n)
+    {
+        auto index = ports_[port][n];
+        auto& enc = encs_[index];
+
+        // skip encoders whose pins didn't change
+        if(!(enc.pin1 / 8 == port && changed & (1 << enc.pin1 % 8))
+        && !(enc.pin2 / 8 == port && changed & (1 << enc.pin2 % 8))) continue;
+
+        auto ab = state(enc);
+        auto step = quad_step(enc.ab, ab);
+        enc.ab = ab;
+
+        if(!step) continue;
+        enc.position += step;
+
+        enc.count += step;
+        if(enc.count == 4 || enc.count == -4)
+        {
+            auto dir = enc.count > 0 ? 1 : -1;
+            enc.count = 0;
+
+            rotate_(index, dir);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+unsigned encoder_bank::state(const enc& enc) const
+{
+    auto bit = [&](pos n) { return (client_->port_value(n / 8) >> n % 8) & 1; };
+    return bit(enc.pin1) << 1 | bit(enc.pin2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_ENCODER_BANK_HPP
+#define FIRMATA_ENCODER_BANK_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/call_chain.hpp"
+#include "firmata/client.hpp"
+#include "firmata/encoder.hpp"
+#include "firmata/pin.hpp"
+#include "firmata/types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Bank of rotary encoders
+//
+// Decodes many encoders straight from port values: there is one port
+// changed callback per port, which visits only the encoders whose pins
+// changed. Encoders are decoded in 4x quadrature (see quad_step) and
+// rotate callbacks are called once per cycle with encoder index.
+//
+class encoder_bank
+{
+public:
+    ////////////////////
+    encoder_bank() = default;
+    explicit encoder_bank(client& c) noexcept : client_(&c) { }
+    ~encoder_bank();
+
+    encoder_bank(const encoder_bank&) = delete;
+    encoder_bank(encoder_bank&& rhs) noexcept { swap(rhs); }
+
+    encoder_bank& operator=(const encoder_bank&) = delete;
+    encoder_bank& operator=(encoder_bank&& rhs) noexcept { swap(rhs); return *this; }
+
+    void swap(encoder_bank&) noexcept;
+
+    ////////////////////
+    bool valid() const noexcept { return client_; }
+    explicit operator bool() const noexcept { return valid(); }
+
+    ////////////////////
+    // add encoder and return its index
+    std::size_t add(pin&, pin&);
+
+    // number of encoders
+    auto size() const noexcept { return encs_.size(); }
+
+    // accumulated position of encoder in counts (4 per cycle)
+    auto position(std::size_t index) const { return encs_.at(index).position; }
+
+    ////////////////////
+    using rotate_call = call<void(std::size_t index, int step)>;
+
+    // install rotate callback
+    cid on_rotate(rotate_call fn) { return rotate_.insert(std::move(fn)); }
+
+    // remove callback
+    bool remove_call(cid id) { return rotate_.erase(id); }
+
+private:
+    ////////////////////
+    client* client_ = nullptr;
+
+    struct enc
+    {
+        pos pin1, pin2;
+        unsigned ab; // last AB state
+        long position;
+        int count; // counts since last rotate call
+    };
+    std::vector<enc> encs_;
+
+    // encoders with pins in each port, bits of those pins
+    // and port changed callbacks
+    std::array<std::vector<std::size_t>, port_count> ports_;
+    std::array<byte, port_count> masks_ { };
+    std::array<cid, port_count> ids_;
+
+    call_chain<rotate_call> rotate_;
+
+    // install port changed callback
+    void bind(pos port);
+    void port_changed(pos port, byte old_value, byte new_value);
+
+    // get AB state of encoder from port values
+    unsigned state(const enc&) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+inline void swap(encoder_bank& lhs, encoder_bank& rhs) noexcept { lhs.swap(rhs); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,137 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "hw_encoder.hpp"
+
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+// encoder commands
+enum : byte
+{
+    attach      = 0x00,
+    report_one  = 0x01,
+    report_all  = 0x02,
+    reset_one   = 0x03,
+    auto_report = 0x04,
+    detach      = 0x05,
+};
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+hw_encoder::hw_encoder(client& c, byte number, pin& pin1, pin& pin2) :
+    client_(&c), number_(number)
+{
+    if(number_ > 0x3f) throw std::invalid_argument("Invalid number");
+
+    if(!pin1.supports(encoder)) throw std::invalid_argument("Invalid pin1");
+    if(!pin2.supports(encoder)) throw std::invalid_argument("Invalid pin2");
+
+    // set mode first, so that reporting is stopped
+    pin1.mode(encoder);
+    pin2.mode(encoder);
+    command(attach, { pin1.pos(), pin2.pos() });
+
+    using namespace std::placeholders;
+    id_ = client_->on_message(encoder_data, std::bind(&hw_encoder::async_read, this, _1, _2));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+hw_encoder::~hw_encoder()
+{
+    if(client_ && client_->remove_io_call(id_))
+        try { command(detach); } catch(...) { }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void hw_encoder::swap(hw_encoder& rhs) noexcept
+{
+    using namespace std::placeholders;
+    using std::swap;
+
+    swap(client_, rhs.client_);
+    swap(number_, rhs.number_);
+    swap(id_    , rhs.id_    );
+
+    // read callbacks are bound to this
+    if(client_ && client_->remove_io_call(id_))
+        id_ = client_->on_message(encoder_data, std::bind(&hw_encoder::async_read, this, _1, _2));
+    if(rhs.client_ && rhs.client_->remove_io_call(rhs.id_))
+        rhs.id_ = rhs.client_->on_message(encoder_data, std::bind(&hw_encoder::async_read, &rhs, _1, _2));
+
+    swap(position_, rhs.position_);
+    swap(time_    , rhs.time_    );
+    swap(chain_   , rhs.chain_   );
+    swap(rotate_  , rhs.rotate_  );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void hw_encoder::query() { command(report_one); }
+
+////////////////////////////////////////////////////////////////////////////////
+void hw_encoder::reset()
+{
+    command(reset_one);
+    position_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void hw_encoder::auto_report(bool value)
+{
+    if(!client_) throw std::logic_error("Invalid state");
+    client_->send(encoder_data, { firmata::auto_report, value });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void hw_encoder::command(byte cmd, payload data)
+{
+    if(!client_) throw std::logic_error("Invalid state");
+
+    data.insert(data.begin(), { cmd, number_ });
+    client_->send(encoder_data, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void hw_encoder::async_read(msg_id, payload_view data)
+{
+    // report for each encoder: direction and number,
+    // followed by 28-bit absolute position (lsb first)
+    for(auto ci = data.begin(); data.end() - ci >= 5; ci += 5)
+    {
+        if((ci[0] & 0x3f) != number_) continue;
+
+        long position = long(ci[1] & 0x7f)
+            | long(ci[2] & 0x7f) << 7
+            | long(ci[3] & 0x7f) << 14
+            | long(ci[4] & 0x7f) << 21;
+        if(ci[0] & 0x40) position = -position;
+
+        if(position != position_)
+        {
+            auto step = static_cast<int>(position - position_);
+
+            position_ = position;
+            time_ = client_->time();
+
+            chain_(position_);
+            rotate_(step);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
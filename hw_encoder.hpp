@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_HW_ENCODER_HPP
+#define FIRMATA_HW_ENCODER_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/call_chain.hpp"
+#include "firmata/client.hpp"
+#include "firmata/pin.hpp"
+#include "firmata/types.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Hardware encoder
+//
+// Encoder decoded on the board (encoder feature of ConfigurableFirmata).
+// Pins are set to encoder mode and attached under given encoder number
+// (0 to 4 on most boards); position is reported on query or, with auto
+// reporting, at every sampling interval.
+//
+class hw_encoder
+{
+public:
+    ////////////////////
+    hw_encoder() = default;
+    hw_encoder(client&, byte number, pin&, pin&);
+    ~hw_encoder();
+
+    hw_encoder(const hw_encoder&) = delete;
+    hw_encoder(hw_encoder&& rhs) noexcept { swap(rhs); }
+
+    hw_encoder& operator=(const hw_encoder&) = delete;
+    hw_encoder& operator=(hw_encoder&& rhs) noexcept { swap(rhs); return *this; }
+
+    void swap(hw_encoder&) noexcept;
+
+    ////////////////////
+    bool valid() const noexcept { return client_; }
+    explicit operator bool() const noexcept { return valid(); }
+
+    // encoder number
+    auto number() const noexcept { return number_; }
+
+    ////////////////////
+    // last position reported by the board
+    auto position() const noexcept { return position_; }
+    // when position last changed (receive time)
+    auto const& time() const noexcept { return time_; }
+
+    // ask board to report position
+    void query();
+    // reset position to 0
+    void reset();
+
+    // enable/disable auto reporting of all encoders on the board
+    void auto_report(bool);
+
+    ////////////////////
+    using int_call = call<void(int)>;
+    using long_call = call<void(long)>;
+
+    // install position changed callback
+    cid on_position_changed(long_call fn) { return chain_.insert(std::move(fn)); }
+    // install rotate callback (called with change of position)
+    cid on_rotate(int_call fn) { return rotate_.insert(std::move(fn)); }
+
+    // remove callback
+    bool remove_call(cid id) { return chain_.erase(id) || rotate_.erase(id); }
+
+private:
+    ////////////////////
+    client* client_ = nullptr;
+    byte number_ = 0;
+
+    cid id_; // read callback
+
+    long position_ = 0;
+    time_point time_;
+
+    call_chain<long_call> chain_ { 0 };
+    call_chain< int_call> rotate_ { 1 };
+
+    // send encoder command
+    void command(byte cmd, payload = { });
+
+    // parse position reports
+    void async_read(msg_id, payload_view);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+inline void swap(hw_encoder& lhs, hw_encoder& rhs) noexcept { lhs.swap(rhs); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
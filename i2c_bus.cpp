@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "i2c_bus.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+constexpr std::size_t i2c_bus::address_count;
+constexpr std::size_t i2c_bus::reg_count;
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+// request modes
+enum : byte
+{
+    write_mode      = 0,
+    read_once       = 1,
+    read_continuous = 2,
+    stop_reading    = 3,
+};
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+i2c_bus::i2c_bus(client& c, const std::chrono::microseconds& delay) : client_(&c)
+{
+    auto n = delay.count();
+    if(n < 0 || n > 0x3fff) throw std::invalid_argument("Invalid delay");
+
+    for(auto& pin : client_->pins())
+        if(pin.supports(i2c) && pin.mode() != i2c) pin.mode(i2c);
+
+    client_->send(i2c_config, { byte(n & 0x7f), byte((n >> 7) & 0x7f) });
+
+    using namespace std::placeholders;
+    id_ = client_->on_message(i2c_reply, std::bind(&i2c_bus::async_read, this, _1, _2));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+i2c_bus::~i2c_bus()
+{
+    if(client_ && client_->remove_io_call(id_))
+    {
+        for(std::size_t address = 0; address < continuous_.size(); ++address)
+            if(continuous_[address])
+                try { request(address, stop_reading); } catch(...) { }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::swap(i2c_bus& rhs) noexcept
+{
+    using namespace std::placeholders;
+    using std::swap;
+
+    swap(client_, rhs.client_);
+    swap(id_    , rhs.id_    );
+
+    // read callbacks are bound to this
+    if(client_ && client_->remove_io_call(id_))
+        id_ = client_->on_message(i2c_reply, std::bind(&i2c_bus::async_read, this, _1, _2));
+    if(rhs.client_ && rhs.client_->remove_io_call(rhs.id_))
+        rhs.id_ = rhs.client_->on_message(i2c_reply, std::bind(&i2c_bus::async_read, &rhs, _1, _2));
+
+    swap(devices_   , rhs.devices_   );
+    swap(continuous_, rhs.continuous_);
+    swap(chain_     , rhs.chain_     );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::write(byte address, const payload& data)
+{
+    request(address, write_mode, std::vector<int>(data.begin(), data.end()));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::write(byte address, byte reg, const payload& data)
+{
+    std::vector<int> values { reg };
+    values.insert(values.end(), data.begin(), data.end());
+
+    request(address, write_mode, values);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::read(byte address, byte reg, std::size_t count)
+{
+    if(!count || count > reg_count) throw std::invalid_argument("Invalid count");
+    request(address, read_once, { reg, int(count) });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::read_continuous(byte address, byte reg, std::size_t count)
+{
+    if(!count || count > reg_count) throw std::invalid_argument("Invalid count");
+    request(address, firmata::read_continuous, { reg, int(count) });
+
+    continuous_.set(address);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::stop(byte address)
+{
+    request(address, stop_reading);
+    continuous_.reset(address);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+byte i2c_bus::value(byte address, byte reg) const
+{
+    auto const& dev = devices_.at(address);
+    return dev ? dev->regs[reg] : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+payload_view i2c_bus::regs(byte address) const
+{
+    auto const& dev = devices_.at(address);
+    return dev ? payload_view(dev->regs.data(), dev->regs.size()) : payload_view();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+time_point i2c_bus::time(byte address) const
+{
+    auto const& dev = devices_.at(address);
+    return dev ? dev->time : time_point();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::request(byte address, byte mode, const std::vector<int>& data)
+{
+    if(!client_) throw std::logic_error("Invalid state");
+    if(address >= address_count) throw std::invalid_argument("Invalid address");
+
+    // 7-bit address; mode goes into bits 3-4
+    payload p { address, byte(mode << 3) };
+    for(auto value : data)
+    {
+        p.push_back(byte(value & 0x7f));
+        p.push_back(byte((value >> 7) & 0x7f));
+    }
+
+    client_->send(i2c_request, p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void i2c_bus::async_read(msg_id, payload_view data)
+{
+    // address, register and data bytes, each as two 7-bit bytes
+    if(data.size() < 4) return;
+
+    auto address = data[0] | (data[1] & 0x7f) << 7;
+    auto reg = data[2] | (data[3] & 0x7f) << 7;
+    if(address >= int(address_count)) return;
+
+    // register is not specified
+    if(reg >= int(reg_count)) reg = 0;
+
+    auto& dev = devices_[address];
+    if(!dev) dev.reset(new device());
+
+    auto count = std::min<std::size_t>((data.size() - 4) / 2, reg_count - reg);
+    auto ci = data.begin() + 4;
+    for(std::size_t n = 0; n < count; ++n, ci += 2)
+        dev->regs[reg + n] = byte((ci[0] & 0x7f) | ci[1] << 7);
+
+    dev->time = client_->time();
+
+    chain_(byte(address), byte(reg), payload_view(dev->regs.data() + reg, count));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_I2C_BUS_HPP
+#define FIRMATA_I2C_BUS_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/call_chain.hpp"
+#include "firmata/client.hpp"
+#include "firmata/types.hpp"
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// I2C bus
+//
+// Sends I2C requests to the board and keeps a register cache for each
+// device (7-bit address). Replies are decoded straight into the cache,
+// so the latest values can be read at any time without I/O. In
+// continuous mode the board keeps reading registers on its own at every
+// sampling interval.
+//
+class i2c_bus
+{
+public:
+    ////////////////////
+    i2c_bus() = default;
+    // delay between writing register and reading data (for slow devices)
+    explicit i2c_bus(client&, const std::chrono::microseconds& delay = { });
+    ~i2c_bus();
+
+    i2c_bus(const i2c_bus&) = delete;
+    i2c_bus(i2c_bus&& rhs) noexcept { swap(rhs); }
+
+    i2c_bus& operator=(const i2c_bus&) = delete;
+    i2c_bus& operator=(i2c_bus&& rhs) noexcept { swap(rhs); return *this; }
+
+    void swap(i2c_bus&) noexcept;
+
+    ////////////////////
+    bool valid() const noexcept { return client_; }
+    explicit operator bool() const noexcept { return valid(); }
+
+    ////////////////////
+    // write data to device
+    void write(byte address, const payload& data);
+    // write data to device register
+    void write(byte address, byte reg, const payload& data);
+
+    // read count bytes from device register once
+    void read(byte address, byte reg, std::size_t count);
+    // read count bytes from device register continuously
+    void read_continuous(byte address, byte reg, std::size_t count);
+
+    // stop continuous reading from device
+    void stop(byte address);
+
+    ////////////////////
+    static constexpr std::size_t address_count = 0x80;
+    static constexpr std::size_t reg_count = 0x100;
+
+    // cached value of device register (0, if never read)
+    byte value(byte address, byte reg) const;
+
+    // cached values of all registers of device (empty, if never read);
+    // valid until next reply from that device
+    payload_view regs(byte address) const;
+
+    // receive time of last reply from device
+    time_point time(byte address) const;
+
+    ////////////////////
+    using reply_call = call<void(byte address, byte reg, payload_view data)>;
+
+    // install reply callback; data points into the cache
+    cid on_reply(reply_call fn) { return chain_.insert(std::move(fn)); }
+
+    // remove callback
+    bool remove_call(cid id) { return chain_.erase(id); }
+
+private:
+    ////////////////////
+    client* client_ = nullptr;
+    cid id_; // read callback
+
+    // register cache
+    struct device
+    {
+        std::array<byte, reg_count> regs { };
+        time_point time;
+    };
+    std::array<std::unique_ptr<device>, address_count> devices_;
+
+    // devices read continuously
+    std::bitset<address_count> continuous_;
+
+    call_chain<reply_call> chain_;
+
+    // send request with data (each value is sent as two 7-bit bytes)
+    void request(byte address, byte mode, const std::vector<int>& data = { });
+
+    // decode replies into cache
+    void async_read(msg_id, payload_view);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+inline void swap(i2c_bus& lhs, i2c_bus& rhs) noexcept { lhs.swap(rhs); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,81 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/io_base.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+constexpr bool is_standard(msg_id id) noexcept
+{ return id >= 0x80 && id <= 0xff && id != start_sysex; }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid io_base::on_read(msg_id first, msg_id last, read_call fn)
+{
+    cid id(2, range_id_++); // token 2 to tell apart from other callbacks
+
+    if(first == last && is_sysex(first))
+        sysex_chains_[first].insert(id, std::move(fn));
+
+    else if(is_standard(first) && first <= last && last <= 0x100)
+    {
+        if(first == last) last = static_cast<msg_id>(last + 1);
+        for(auto n = first; n < last; n = static_cast<msg_id>(n + 1))
+            std_chains_[n - 0x80].insert(id, fn);
+    }
+    else throw std::invalid_argument("Invalid id range");
+
+    ranges_.emplace(id, std::make_tuple(first, last));
+    return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool io_base::remove_call(cid id)
+{
+    auto ri = ranges_.find(id);
+    if(ri == ranges_.end()) return chain_.erase(id);
+
+    msg_id first, last;
+    std::tie(first, last) = ri->second;
+    ranges_.erase(ri);
+
+    if(is_sysex(first))
+    {
+        // chain is kept, since it may be the one being called
+        auto ci = sysex_chains_.find(first);
+        if(ci != sysex_chains_.end()) ci->second.erase(id);
+    }
+    else for(auto n = first; n < last; n = static_cast<msg_id>(n + 1))
+        std_chains_[n - 0x80].erase(id);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void io_base::dispatch(msg_id id, payload_view data)
+{
+    if(precise_) time_ = std::chrono::steady_clock::now();
+
+    if(is_sysex(id))
+    {
+        auto ci = sysex_chains_.find(id);
+        if(ci != sysex_chains_.end()) ci->second(id, data);
+    }
+    else if(is_standard(id)) std_chains_[id - 0x80](id, data);
+
+    chain_(id, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
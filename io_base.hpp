@@ -12,13 +12,36 @@
 #include "firmata/call_chain.hpp"
 #include "firmata/types.hpp"
 
+#include <array>
+#include <cstddef>
 #include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace firmata
 {
 
+////////////////////////////////////////////////////////////////////////////////
+struct timeout_error : public std::runtime_error { using std::runtime_error::runtime_error; };
+struct queue_full : public std::runtime_error { using std::runtime_error::runtime_error; };
+
+namespace literals
+{
+
+// what to do when outgoing queue is full:
+// block until there is room, reject message by throwing queue_full,
+// or let latest value replace queued one for the same pin (and block otherwise)
+enum overflow { block, reject, latest_wins };
+
+}
+
+using namespace literals;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Firmata protocol I/O base class
 //
@@ -29,22 +52,82 @@ public:
     // write message
     virtual void write(msg_id, const payload& = { }) = 0;
 
-    using read_call = call<void(msg_id, const payload&)>;
+    // send out queued messages (if write is buffered)
+    virtual void flush() { }
+
+    // limit outgoing queue size (in bytes)
+    void queue_limit(std::size_t size, overflow policy = block) noexcept
+    { limit_ = size; policy_ = policy; }
 
-    // install read callback
+    // current queue limit and policy
+    auto queue_limit() const noexcept { return limit_; }
+    auto queue_policy() const noexcept { return policy_; }
+
+    // message data passed to read callbacks is only valid
+    // for the duration of the call; copy it if needed later
+    //
+    // it stays valid, if the callback blocks (eg, in wait_until) and
+    // more messages are read meanwhile, unless they fill up the read
+    // buffer of serial_port (4K)
+    using read_call = call<void(msg_id, payload_view)>;
+
+    // install read callback for all messages
     virtual cid on_read(read_call fn) { return chain_.insert(std::move(fn)); }
 
-    // remove read callback
-    virtual bool remove_call(cid id) { return chain_.erase(id); }
+    // install read callback for one message id
+    virtual cid on_read(msg_id id, read_call fn) { return on_read(id, id, std::move(fn)); }
+
+    // install read callback for range [first, last)
+    // of standard ids (eg, port_value_base, port_value_end)
+    virtual cid on_read(msg_id first, msg_id last, read_call);
+
+    // remove read (or timeout) callback
+    virtual bool remove_call(cid);
+
+    using timeout_call = call<void()>;
+
+    // install callback to be called once after timeout
+    virtual cid on_timeout(const msec&, timeout_call) = 0;
 
     using condition = std::function<bool()>;
 
     // block until condition or timeout
     virtual bool wait_until(const condition&, const msec&) = 0;
 
+    ////////////////////
+    // receive time of message being dispatched: when its read
+    // completed, or when it was parsed (if precise time is enabled)
+    auto const& time() const noexcept { return time_; }
+
+    // enable/disable precise (per message) time
+    void precise_time(bool value) noexcept { precise_ = value; }
+    auto precise_time() const noexcept { return precise_; }
+
 protected:
     ////////////////////
+    // callbacks for all messages
     call_chain<read_call> chain_;
+
+    // callbacks for standard ids (indexed by id - 0x80)
+    // and for sysex and extended sysex ids
+    std::array<call_chain<read_call>, 0x80> std_chains_;
+    std::unordered_map<dword, call_chain<read_call>> sysex_chains_;
+
+    // id ranges of the above callbacks
+    std::map<cid, std::tuple<msg_id, msg_id>> ranges_;
+    unsigned range_id_ = 0;
+
+    // are there any read callbacks
+    bool reading() const noexcept { return !chain_.empty() || !ranges_.empty(); }
+
+    // call read callbacks for the message
+    void dispatch(msg_id, payload_view);
+
+    std::size_t limit_ = std::numeric_limits<std::size_t>::max();
+    overflow policy_ = block;
+
+    time_point time_;
+    bool precise_ = false;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -24,9 +24,28 @@ void pin::swap(pin& rhs) noexcept
     swap(mode_    , rhs.mode_    );
     swap(value_   , rhs.value_   );
     swap(state_   , rhs.state_   );
-    swap(changed_ , rhs.changed_ );
-    swap(low_     , rhs.low_     );
-    swap(high_    , rhs.high_    );
+    swap(time_    , rhs.time_    );
+    swap(chains_  , rhs.chains_  );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::set<firmata::mode> pin::modes() const
+{
+    std::set<firmata::mode> modes;
+    for(std::size_t n = 0; n < mode_count; ++n)
+        if(modes_ & (1 << n)) modes.insert(static_cast<firmata::mode>(n));
+    return modes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void pin::add(firmata::mode mode, firmata::res res)
+{
+    // modes beyond mode_count are not defined by the protocol
+    if(mode < mode_count)
+    {
+        modes_ |= 1 << mode;
+        reses_[mode] = res;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -68,22 +87,34 @@ void pin::value(int value)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-cid pin::on_state_changed(int_call fn) { return changed_.insert(std::move(fn)); }
-cid pin::on_state_low(void_call fn) { return low_.insert(std::move(fn)); }
-cid pin::on_state_high(void_call fn) { return high_.insert(std::move(fn)); }
+cid pin::on_state_changed(int_call fn) { return get_chains().changed.insert(std::move(fn)); }
+cid pin::on_state_low(void_call fn) { return get_chains().low.insert(std::move(fn)); }
+cid pin::on_state_high(void_call fn) { return get_chains().high.insert(std::move(fn)); }
 
 bool pin::remove_call(cid id)
 {
-    return changed_.erase(id) || low_.erase(id) || high_.erase(id);
+    return chains_ && (chains_->changed.erase(id) || chains_->low.erase(id) || chains_->high.erase(id));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+pin::chains& pin::get_chains()
+{
+    if(!chains_) chains_.reset(new chains);
+    return *chains_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void pin::state(int state)
+void pin::state(int state, const time_point& time)
 {
     if(state_ != state)
     {
-        changed_(state_ = state);
-        if(state_) high_(); else low_();
+        state_ = state;
+        time_ = time;
+        if(chains_)
+        {
+            chains_->changed(state_);
+            if(state_) chains_->high(); else chains_->low();
+        }
     }
 }
 
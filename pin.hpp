@@ -9,10 +9,14 @@
 #define FIRMATA_PIN_HPP
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "firmata/awaitable.hpp"
 #include "firmata/call_chain.hpp"
+#include "firmata/io_base.hpp"
 #include "firmata/types.hpp"
 
-#include <map>
+#include <array>
+#include <cstddef>
+#include <memory>
 #include <set>
 #include <utility>
 
@@ -20,6 +24,8 @@
 namespace firmata
 {
 
+class client;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Firmata pin
 //
@@ -47,8 +53,9 @@ public:
     auto analog() const noexcept { return analog_; }
 
     // supported modes
-    auto const& modes() const noexcept { return modes_; }
-    bool supports(firmata::mode mode) const noexcept { return modes_.count(mode); }
+    std::set<firmata::mode> modes() const;
+    bool supports(firmata::mode mode) const noexcept
+    { return mode < mode_count && (modes_ & (1 << mode)); }
 
     // current mode
     auto mode() const noexcept { return mode_; }
@@ -56,7 +63,7 @@ public:
     void mode(firmata::mode);
 
     // current mode res (in bits)
-    auto res() const noexcept { return reses_.at(mode_); }
+    auto res() const noexcept { return mode_ < mode_count ? reses_[mode_] : firmata::res(0); }
 
     // current value
     auto value() const noexcept { return value_; }
@@ -65,6 +72,8 @@ public:
 
     // current state
     auto state() const noexcept { return state_; }
+    // when state last changed (receive time)
+    auto const& time() const noexcept { return time_; }
 
     ////////////////////
     using int_call = call<void(int)>;
@@ -78,24 +87,52 @@ public:
     // remove callback
     bool remove_call(cid);
 
+#ifdef FIRMATA_COROUTINES
+    ////////////////////
+    // wait for state to change: int state = co_await pin.next_state();
+    // throws timeout_error, if it doesn't change within the given time
+    awaitable<int> next_state(const msec& time = forever)
+    {
+        return awaitable<int>([this](awaitable<int>::done_call fn) -> call<void()>
+        {
+            auto id = on_state_changed([fn](int state) { fn(std::error_code(), state); });
+            return [this, id]() { remove_call(id); };
+        }, delegate_ ? delegate_->io : nullptr, time);
+    }
+#endif
+
 private:
     ////////////////////
+    // hot fields first; callbacks are kept out of line,
+    // so that pins stay small (56 bytes on 64-bit) and sit close together
     firmata::pos pos_ = npos, analog_ = npos;
+    firmata::mode mode_; // current mode
 
-    std::set<firmata::mode> modes_;
-    std::map<firmata::mode, firmata::res> reses_; // res (bits) for each mode
+    static constexpr std::size_t mode_count = 16;
+    word modes_ = 0; // supported modes (bit mask)
 
-    firmata::mode mode_; // current mode
     int value_ = 0; // current value
     int state_ = 0; // current state
+    time_point time_; // when state changed
+
+    std::array<firmata::res, mode_count> reses_ { }; // res (bits) for each mode
+
+    // add supported mode
+    void add(firmata::mode, firmata::res);
 
     // state changed/low/high call chains
-    call_chain< int_call> changed_ { 0 };
-    call_chain<void_call> low_     { 1 };
-    call_chain<void_call> high_    { 2 };
+    struct chains
+    {
+        call_chain< int_call> changed { 0 };
+        call_chain<void_call> low     { 1 };
+        call_chain<void_call> high    { 2 };
+    };
+    std::unique_ptr<chains> chains_; // allocated on first use
+
+    chains& get_chains();
 
-    // set new state
-    void state(int);
+    // set new state (received at given time)
+    void state(int, const time_point&);
 
     ////////////////////
     // delegate for setting new mode/value
@@ -108,6 +145,9 @@ private:
         call<void(firmata::pos, int)> analog_value;
 
         call<void(firmata::pos, firmata::mode)> pin_mode;
+
+        io_base* io = nullptr; // for timeouts
+        firmata::client* client = nullptr; // owner (eg, for encoder)
     };
 
     delegate* delegate_ = nullptr;
@@ -115,6 +155,7 @@ private:
     ////////////////////
     pin(firmata::pos pos, delegate* del) : pos_(pos), delegate_(del) { }
     friend class client;
+    friend class encoder;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -27,16 +27,38 @@ const firmata::pin& pins::get(firmata::mode mode, firmata::pos pos) const
     {
         // analog pins are treated specially,
         // as they may be numbered differently
-        for(auto& pin : *this) if(pin.analog() == pos) return pin;
+        if(pos < analogs_.size() && analogs_[pos] != npos) return at(analogs_[pos]);
     }
     else
     {
         // other pins don't have specific numbers
-        for(auto& pin : *this) if(pin.supports(mode) && 0 == pos--) return pin;
+        if(mode < modes_.size() && pos < modes_[mode].size()) return at(modes_[mode][pos]);
     }
 
     throw std::out_of_range("Pin not found");
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void pins::index()
+{
+    analogs_.clear();
+    modes_.clear();
+
+    for(auto& pin : *this)
+    {
+        if(pin.analog() != npos)
+        {
+            if(pin.analog() >= analogs_.size()) analogs_.resize(pin.analog() + 1, npos);
+            analogs_[pin.analog()] = pin.pos();
+        }
+
+        for(auto mode : pin.modes())
+        {
+            if(mode >= modes_.size()) modes_.resize(mode + 1);
+            modes_[mode].push_back(pin.pos());
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 }
@@ -12,7 +12,6 @@
 #include "firmata/pin.hpp"
 #include "firmata/types.hpp"
 
-#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -51,11 +50,7 @@ public:
     auto count() const noexcept { return size(); }
     // number of pins that support certain mode
     auto count(mode n) const noexcept
-    {
-        return std::count_if(begin(), end(),
-            [&](auto& pin){ return pin.supports(n); }
-        );
-    }
+    { return n < modes_.size() ? modes_[n].size() : 0; }
 
     ////////////////////
     // get pin
@@ -70,6 +65,23 @@ public:
     firmata::pin& get(mode, pos);
     const firmata::pin& get(mode, pos) const;
 
+private:
+    ////////////////////
+    // lookup tables: analog channel -> pin,
+    // and mode -> pins that support it
+    std::vector<pos> analogs_;
+    std::vector<std::vector<pos>> modes_;
+
+    // build lookup tables (after pins have been added)
+    void index();
+
+    // find analog pin (nullptr if not found)
+    firmata::pin* find(analog n) noexcept
+    {
+        return n < analogs_.size() && analogs_[n] != npos
+            ? &(*this)[analogs_[n]] : nullptr;
+    }
+
     friend class client;
 };
 
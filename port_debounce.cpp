@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "port_debounce.hpp"
+
+#include <functional>
+#include <stdexcept>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+void port_debounce::poll_interval(const msec& poll) noexcept
+{
+    poll_ = poll;
+    for(auto& p : ports_) if(p) p->poll_ = poll;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid port_debounce::on_state_changed(firmata::pin& pin, pin::int_call fn)
+{
+    if(!client_) throw std::logic_error("Invalid state");
+
+    if(pin.mode() != digital_in && pin.mode() != pullup_in)
+        throw std::invalid_argument("Invalid pin mode");
+
+    unsigned n = pin.pos() / 8, bit = pin.pos() % 8;
+    if(n >= ports_.size()) throw std::invalid_argument("Invalid pin");
+
+    auto& p = ports_[n];
+    if(!p) p.reset(new port(*client_, n, poll_));
+    if(!p->mask_) p->bind();
+
+    // start from current state of the pin
+    if(!p->uses_[bit]++)
+    {
+        if(pin.state()) p->state_ |= 1 << bit;
+        else p->state_ &= ~(1 << bit);
+        p->mask_ |= 1 << bit;
+    }
+
+    // token is port number and id carries pin bit
+    cid id(n, id_++ << 3 | bit);
+    p->calls_.insert(id, [bit, fn](byte toggle, byte state)
+        { if(toggle & (1 << bit)) fn(bool(state & (1 << bit))); }
+    );
+    return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid port_debounce::on_state_low(firmata::pin& pin, pin::void_call fn)
+{
+    return on_state_changed(pin, [=](int state){ if(!state) fn(); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+cid port_debounce::on_state_high(firmata::pin& pin, pin::void_call fn)
+{
+    return on_state_changed(pin, [=](int state){ if(state) fn(); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool port_debounce::remove_call(cid id)
+{
+    auto n = std::get<0>(id);
+    if(n >= ports_.size() || !ports_[n]) return false;
+
+    auto& p = *ports_[n];
+    if(!p.calls_.erase(id)) return false;
+
+    // stop debouncing pins without callbacks
+    auto bit = std::get<1>(id) & 7;
+    if(!--p.uses_[bit])
+    {
+        p.mask_ &= ~(1 << bit);
+        p.cnt0_ &= p.mask_;
+        p.cnt1_ &= p.mask_;
+    }
+
+    if(!p.mask_) p.unbind();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+port_debounce::port::~port() noexcept { if(mask_) unbind(); }
+
+////////////////////////////////////////////////////////////////////////////////
+void port_debounce::port::bind()
+{
+    using namespace std::placeholders;
+    id_ = client_.on_port_report(pos_, std::bind(&port::port_report, this, _1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void port_debounce::port::unbind()
+{
+    client_.remove_call(id_);
+    if(polling_) { client_.remove_io_call(poll_id_); polling_ = false; }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void port_debounce::port::port_report(byte value)
+{
+    // count up bits that differ from debounced state
+    // and reset the rest; toggle on overflow
+    byte delta = (value ^ state_) & mask_;
+    cnt1_ = (cnt1_ ^ cnt0_) & delta;
+    cnt0_ = ~cnt0_ & delta;
+
+    byte toggle = delta & ~(cnt0_ | cnt1_);
+    state_ ^= toggle;
+
+    // keep polling until all bits settle
+    if(cnt0_ | cnt1_)
+    {
+        if(!polling_)
+        {
+            poll_id_ = client_.on_timeout(poll_, [this]()
+                { polling_ = false; client_.query_port(pos_); }
+            );
+            polling_ = true;
+        }
+    }
+    else if(polling_) { client_.remove_io_call(poll_id_); polling_ = false; }
+
+    // callbacks may remove themselves
+    if(toggle) calls_(toggle, state_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_PORT_DEBOUNCE_HPP
+#define FIRMATA_PORT_DEBOUNCE_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/call_chain.hpp"
+#include "firmata/client.hpp"
+#include "firmata/pin.hpp"
+#include "firmata/types.hpp"
+
+#include <array>
+#include <memory>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Port debouncer
+//
+// Integrates raw port reports with a 2-bit vertical counter per pin:
+// a pin's debounced state only changes once it has been read in the new
+// state 4 times in a row. All pins of a port are handled at once with
+// a few bitwise operations per report. While any pin is unsettled, the
+// port is polled once per poll interval, so a change goes through after
+// about 4 intervals (or 4 round trips to the host, if the link is slower).
+//
+class port_debounce
+{
+public:
+    ////////////////////
+    port_debounce() noexcept = default;
+    explicit port_debounce(client& c, const msec& poll = msec(5)) noexcept :
+        client_(&c), poll_(poll)
+    { }
+
+    port_debounce(const port_debounce&) = delete;
+    port_debounce(port_debounce&& rhs) noexcept { swap(rhs); }
+
+    port_debounce& operator=(const port_debounce&) = delete;
+    port_debounce& operator=(port_debounce&& rhs) noexcept { swap(rhs); return *this; }
+
+    void swap(port_debounce& rhs) noexcept
+    {
+        using std::swap;
+        swap(client_, rhs.client_);
+        swap(poll_  , rhs.poll_  );
+        swap(ports_ , rhs.ports_ );
+        swap(id_    , rhs.id_    );
+    }
+
+    ////////////////////
+    bool valid() const noexcept { return client_; }
+    explicit operator bool() const noexcept { return valid(); }
+
+    ////////////////////
+    // set interval between polls of unsettled ports
+    void poll_interval(const msec&) noexcept;
+    auto const& poll_interval() const noexcept { return poll_; }
+
+    ////////////////////
+    // install state changed/low/high callback
+    cid on_state_changed(pin&, pin::int_call);
+    cid on_state_low(pin&, pin::void_call);
+    cid on_state_high(pin&, pin::void_call);
+
+    // remove callback
+    bool remove_call(cid);
+
+private:
+    ////////////////////
+    client* client_ = nullptr;
+    msec poll_ { 5 };
+
+    struct port
+    {
+        ////////////////////
+        port(client& c, pos n, const msec& poll) noexcept :
+            client_(c), pos_(n), poll_(poll), calls_(n)
+        { }
+        ~port() noexcept;
+
+        client& client_; pos pos_; msec poll_;
+
+        // debounced state and vertical counter bits
+        byte state_ = 0, cnt0_ = 0, cnt1_ = 0;
+
+        // bits to debounce and number of callbacks per bit
+        byte mask_ = 0;
+        std::array<unsigned, 8> uses_ { };
+
+        // called with toggled bits and new state
+        using toggle_call = call<void(byte toggle, byte state)>;
+        call_chain<toggle_call> calls_;
+
+        // subscribe to port reports, while there are callbacks
+        cid id_; void bind(); void unbind();
+
+        // pending poll
+        cid poll_id_; bool polling_ = false;
+
+        void port_report(byte value);
+    };
+
+    // ports with callbacks (created on demand and kept,
+    // since callbacks may be removed while they are called)
+    std::array<std::unique_ptr<port>, port_count> ports_;
+    unsigned id_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+inline void swap(port_debounce& lhs, port_debounce& rhs) noexcept { lhs.swap(rhs); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/samples.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+samples::samples(std::size_t capacity)
+{
+    if(!capacity) throw std::invalid_argument("Invalid capacity");
+    ring_.resize(capacity);
+    sums_.resize(capacity);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void samples::push(time_point time, int value)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto n = total_++;
+    ring_[n % ring_.size()] = sample { time, value };
+    sums_[n % ring_.size()] = sum_;
+    sum_ += value;
+
+    // drop overwritten samples
+    auto first = total_ - std::min(total_, ring_.size());
+    while(min_.size() && min_.front() < first) min_.pop_front();
+    while(max_.size() && max_.front() < first) max_.pop_front();
+
+    // and those that can no longer be min (max)
+    auto value_of = [&](std::size_t k) { return ring_[k % ring_.size()].value; };
+    while(min_.size() && value_of(min_.back()) >= value) min_.pop_back();
+    while(max_.size() && value_of(max_.back()) <= value) max_.pop_back();
+
+    min_.push_back(n);
+    max_.push_back(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+samples::stats samples::aggregate(const msec& window) const
+{
+    auto since = clock::now() - window;
+    stats s;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto value_of = [&](std::size_t k) { return ring_[k % ring_.size()].value; };
+
+    // find first sample within window
+    // (receive times don't decrease)
+    auto lo = total_ - std::min(total_, ring_.size()), hi = total_;
+    while(lo < hi)
+    {
+        auto mid = lo + (hi - lo) / 2;
+        if(ring_[mid % ring_.size()].time < since) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == total_) return s;
+
+    s.count = total_ - lo;
+    s.last = value_of(total_ - 1);
+    s.mean = double(sum_ - sums_[lo % ring_.size()]) / s.count;
+
+    // min (max) of samples since lo is the first candidate at or after it
+    s.min = value_of(*std::lower_bound(min_.begin(), min_.end(), lo));
+    s.max = value_of(*std::lower_bound(max_.begin(), max_.end(), lo));
+
+    return s;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t samples::read(std::size_t& cursor, std::vector<sample>& out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // skip overwritten samples
+    if(cursor > total_) cursor = total_;
+    if(total_ - cursor > ring_.size()) cursor = total_ - ring_.size();
+
+    auto count = total_ - cursor;
+    out.reserve(out.size() + count);
+
+    for(; cursor < total_; ++cursor) out.push_back(ring_[cursor % ring_.size()]);
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_SAMPLES_HPP
+#define FIRMATA_SAMPLES_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/types.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Sample history
+//
+// Ring buffer of last N (receive time, value) samples. Samples are added
+// from the io thread, and can be read from any other thread.
+//
+// Running sums and min/max candidates are kept as samples are added,
+// so that aggregates over any window take O(log N) rather than a walk
+// over the whole window.
+//
+class samples
+{
+public:
+    ////////////////////
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+
+    struct sample { time_point time; int value; };
+
+    explicit samples(std::size_t capacity);
+
+    samples(const samples&) = delete;
+    samples& operator=(const samples&) = delete;
+
+    ////////////////////
+    // max number of samples kept
+    auto capacity() const noexcept { return ring_.size(); }
+
+    // add sample
+    void push(time_point, int value);
+
+    ////////////////////
+    struct stats
+    {
+        std::size_t count = 0;
+        int min = 0, max = 0, last = 0;
+        double mean = 0;
+    };
+
+    // aggregate samples received within time before now
+    stats aggregate(const msec& window) const;
+
+    ////////////////////
+    // Samples are numbered in order they are added; cursor is the
+    // number of the next sample to read (start with 0). Samples that
+    // have been overwritten in the meantime are skipped.
+    //
+    // append samples since cursor to out and advance cursor;
+    // return number of samples read
+    std::size_t read(std::size_t& cursor, std::vector<sample>& out) const;
+
+private:
+    ////////////////////
+    mutable std::mutex mutex_;
+
+    std::vector<sample> ring_;
+    std::size_t total_ = 0; // number of samples ever added
+
+    // sum of all values ever added and sum before each sample
+    long long sum_ = 0;
+    std::vector<long long> sums_;
+
+    // numbers of samples, which are min (max) of all samples after them
+    // (values increase from front to back for min_ and decrease for max_)
+    std::deque<std::size_t> min_, max_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -16,6 +16,24 @@
 namespace firmata
 {
 
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+// get key for pin value updates (0 for other messages)
+dword value_key(msg_id id, const payload& data)
+{
+    if((id >= port_value_base && id < port_value_end)
+    || (id >= analog_value_base && id < analog_value_end)) return id;
+
+    if((id == digital_value || id == ext_analog_value) && data.size())
+        return (dword(id) << 8) + data[0];
+
+    return 0;
+}
+
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 serial_port::serial_port(asio::io_service& io, const std::string& device) :
     port_(io, device), timer_(io)
@@ -26,6 +44,7 @@ serial_port::~serial_port() noexcept
 {
     port_.cancel();
     timer_.cancel();
+    for(auto& ti : timers_) ti.second->cancel();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -38,15 +57,46 @@ void serial_port::set(char_size    bits) { port_.set_option(asio::serial_port::c
 ////////////////////////////////////////////////////////////////////////////////
 void serial_port::write(msg_id id, const payload& data)
 {
-    std::vector<asio::const_buffer> message;
+    auto key = policy_ == latest_wins ? value_key(id, data) : 0;
+    auto vi = std::find_if(values_.begin(), values_.end(),
+        [&](auto const& value){ return std::get<0>(value) == key; }
+    );
+    bool replace = key && vi != values_.end();
 
-        message.push_back(asio::buffer(&id, size(id)));
-    if(data.size())
-        message.push_back(asio::buffer(data));
-    if(is_sysex(id))
-        message.push_back(asio::buffer(&end_sysex, sizeof(end_sysex)));
+    auto length = size(id) + data.size() + (is_sysex(id) ? 1 : 0);
+    if(!replace && queue_.size() + length > limit_)
+    {
+        if(policy_ == reject) throw queue_full("Queue is full");
 
-    asio::write(port_, message);
+        // wait until current write is done
+        // and the queue moves on
+        while(writing_ && queue_.size() + length > limit_)
+        {
+            port_.get_io_service().reset();
+            port_.get_io_service().run_one();
+        }
+    }
+
+    // encode message into the queue
+    auto offset = queue_.size();
+    for(std::size_t n = 0; n < size(id); ++n) queue_.push_back(byte(id >> (8 * n)));
+    queue_.insert(queue_.end(), data.begin(), data.end());
+    if(is_sysex(id)) queue_.push_back(end_sysex);
+
+    if(replace) replace_value(vi, offset);
+    else if(key) values_.emplace_back(key, offset, length);
+
+    sched_write();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void serial_port::flush()
+{
+    while(writing_)
+    {
+        port_.get_io_service().reset();
+        port_.get_io_service().run_one();
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -56,14 +106,63 @@ cid serial_port::on_read(read_call fn)
     return io_base::on_read(std::move(fn));
 }
 
+cid serial_port::on_read(msg_id id, read_call fn)
+{
+    return on_read(id, id, std::move(fn));
+}
+
+cid serial_port::on_read(msg_id first, msg_id last, read_call fn)
+{
+    auto id = io_base::on_read(first, last, std::move(fn));
+    sched_async();
+    return id;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 bool serial_port::remove_call(cid id)
 {
+    auto ti = timers_.find(id);
+    if(ti != timers_.end())
+    {
+        ti->second->cancel();
+        timers_.erase(ti);
+        return true;
+    }
+
     auto value = io_base::remove_call(id);
-    if(chain_.empty()) { port_.cancel(); timer_.cancel(); }
+    if(!reading())
+    {
+        // stop reading, unless it would abort pending write
+        // (in which case async_write will take care of it)
+        if(!writing_) port_.cancel();
+        timer_.cancel();
+    }
     return value;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+cid serial_port::on_timeout(const msec& time, timeout_call fn)
+{
+    cid id(1, timer_id_++); // token 1 to tell apart from read callbacks
+
+    auto ti = timers_.emplace(id, std::unique_ptr<asio::system_timer>
+        { new asio::system_timer(port_.get_io_service()) }
+    ).first;
+
+    ti->second->expires_from_now(time);
+    ti->second->async_wait([this, id, fn](const asio::error_code& ec)
+    {
+        // timer could have been removed after it expired
+        auto ti = timers_.find(id);
+        if(ec || ti == timers_.end()) return;
+
+        timers_.erase(ti);
+        fn();
+    });
+
+    return id;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 bool serial_port::wait_until(const condition& cond, const msec& time)
 {
@@ -73,7 +172,7 @@ bool serial_port::wait_until(const condition& cond, const msec& time)
     {
         timer_.expires_from_now(time);
         timer_.async_wait([&](const asio::error_code& ec)
-            { if(!ec) { expired = true; port_.cancel(); } }
+            { if(!ec) expired = true; }
         );
     }
 
@@ -90,13 +189,34 @@ bool serial_port::wait_until(const condition& cond, const msec& time)
     return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+constexpr std::size_t serial_port::ring_size;
+
 ////////////////////////////////////////////////////////////////////////////////
 void serial_port::sched_async()
 {
     using namespace std::placeholders;
 
-    // read into single read buffer
-    port_.async_read_some(asio::buffer(one_),
+    if(reading_) return;
+
+    // ring is full with message being dispatched by a blocked callback;
+    // release it (its data view is no longer valid)
+    if(depth_ && tail_ - hold_ == ring_size) hold_ = head_;
+
+    // ring is full with a partial message, which will never fit;
+    // discard it and start over
+    if(tail_ - head_ == ring_size)
+    {
+        head_ = next_ = tail_;
+        state_ = idle;
+    }
+
+    // read into contiguous free space of the ring
+    auto begin = wrap(tail_);
+    auto n = std::min(ring_size - begin, ring_size - (tail_ - used()));
+
+    reading_ = true;
+    port_.async_read_some(asio::buffer(&ring_[begin], n),
         std::bind(&serial_port::async_read, this, _1, _2)
     );
 }
@@ -104,83 +224,179 @@ void serial_port::sched_async()
 ////////////////////////////////////////////////////////////////////////////////
 void serial_port::async_read(const asio::error_code& ec, std::size_t n)
 {
+    reading_ = false;
+
+    // read was cancelled, when the last read callback was removed;
+    // start over, if new ones were installed in the meantime
+    if(ec == asio::error::operation_aborted && reading()) sched_async();
     if(ec) return;
 
-    // copy data into overall buffer
-    overall_.insert(overall_.end(), std::begin(one_), std::next(one_, n));
+    time_ = std::chrono::steady_clock::now();
 
-    msg_id id;
-    payload data;
+    // mirror new data into second half of the ring
+    auto ci = std::next(ring_.begin(), wrap(tail_));
+    std::copy(ci, std::next(ci, n), std::next(ci, ring_size));
+    tail_ += n;
 
-    // parse messages until none left
-    std::tie(id, data) = parse_one();
-
-    while(data.size())
-    {
-        chain_(id, data);
-        std::tie(id, data) = parse_one();
-    }
+    parse();
 
     sched_async();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-std::tuple<msg_id, payload> serial_port::parse_one()
+void serial_port::sched_write()
 {
-    msg_id id;
-    payload data;
+    using namespace std::placeholders;
 
-    do
-    {
-        // discard garbage
-        auto gi = std::find_if(overall_.begin(), overall_.end(),
-            [](auto ch){ return ch >= 0x80 && ch != end_sysex; }
-        );
-        overall_.erase(overall_.begin(), gi);
+    // one write at a time
+    if(writing_ || queue_.empty()) return;
 
-        // check for minimum message size
-        if(overall_.size() < 3) break;
+    using std::swap;
+    swap(queue_, sending_);
+    values_.clear();
 
-        auto ci = overall_.begin();
+    writing_ = true;
+    asio::async_write(port_, asio::buffer(sending_),
+        std::bind(&serial_port::async_write, this, _1, _2)
+    );
+}
 
-        // get message id
-        id = static_cast<msg_id>(*ci++);
+////////////////////////////////////////////////////////////////////////////////
+void serial_port::async_write(const asio::error_code& ec, std::size_t)
+{
+    writing_ = false;
+    sending_.clear(); // keep capacity for next time
+    if(ec) return;
 
-        // if sysex message, get sysex id
-        if(is_sysex(id))
-        {
-            id = sysex(*ci++);
+    if(queue_.size()) sched_write();
 
-            // if extended sysex message, get extended id
-            if(is_ext_sysex(id))
+    // nobody is listening anymore
+    else if(!reading()) port_.cancel();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void serial_port::replace_value(value_iterator vi, std::size_t offset)
+{
+    std::size_t old_offset, old_size;
+    std::tie(std::ignore, old_offset, old_size) = *vi;
+
+    auto ci = std::next(queue_.begin(), old_offset);
+    auto new_size = queue_.size() - offset;
+
+    if(old_size == new_size && old_offset + old_size == offset)
+    {
+        // stale value is last in the queue; overwrite in place
+        std::copy(std::next(queue_.begin(), offset), queue_.end(), ci);
+        queue_.resize(offset);
+    }
+    else
+    {
+        // other messages (eg, pin_mode for the same pin) were queued after
+        // stale value; drop it and keep new one at the end to preserve order
+        queue_.erase(ci, std::next(ci, old_size));
+        for(auto& value : values_)
+            if(std::get<1>(value) > old_offset) std::get<1>(value) -= old_size;
+
+        std::get<1>(*vi) = queue_.size() - new_size;
+        std::get<2>(*vi) = new_size;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void serial_port::parse()
+{
+    while(next_ != tail_)
+    {
+        auto ch = ring_[wrap(next_++)];
+
+        if(ch & 0x80)
+        {
+            if(ch == end_sysex)
             {
-                // need 2 bytes for extended id
-                if(overall_.size() < 4) break;
-                id = ext_sysex(word(*ci++) + (word(*ci++) << 7));
+                if(state_ == sysex_data)
+                {
+                    state_ = idle;
+                    dispatch(begin_, next_ - 1); // chomp end_sysex
+                }
+                else
+                {
+                    // discard garbage
+                    head_ = next_;
+                    state_ = idle;
+                }
             }
+            else
+            {
+                // start of new message,
+                // drop partial message (if any)
+                head_ = next_ - 1;
 
-            // find end_sysex
-            for(auto ci_end = ci; ci_end != overall_.end(); ++ci_end)
-                if(*ci_end == end_sysex)
+                if(ch == start_sysex) state_ = sysex_id;
+                else
                 {
-                    // xfer from overall_ to data
-                    data.insert(data.end(), ci, ci_end);
-                    overall_.erase(overall_.begin(), std::next(ci_end)); // chomp end_sysex
-                    break;
+                    id_ = static_cast<msg_id>(ch);
+                    begin_ = next_;
+                    state_ = standard;
                 }
+            }
         }
-        else
+        else switch(state_)
         {
-            // standard message
-            // xfer from overall_ to data
-            auto ci_end = ci + 2;
-            data.insert(data.end(), ci, ci_end);
-            overall_.erase(overall_.begin(), ci_end);
+        case idle:
+            // discard garbage
+            head_ = next_;
+            break;
+
+        case standard:
+            // standard message has 2 bytes of data
+            if(next_ - begin_ == 2)
+            {
+                state_ = idle;
+                dispatch(begin_, next_);
+            }
+            break;
+
+        case sysex_id:
+            id_ = sysex(ch);
+            begin_ = next_;
+            // if extended sysex message, get extended id
+            state_ = is_ext_sysex(id_) ? ext_id : sysex_data;
+            break;
+
+        case ext_id:
+            // need 2 bytes for extended id
+            if(next_ - begin_ == 2)
+            {
+                id_ = ext_sysex(word(ring_[wrap(begin_)]) + (word(ch) << 7));
+                begin_ = next_;
+                state_ = sysex_data;
+            }
+            break;
+
+        case sysex_data:
+            break;
         }
     }
-    while(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void serial_port::dispatch(std::size_t begin, std::size_t end)
+{
+    auto id = id_;
+
+    // message is contiguous thanks to the mirror,
+    // so pass it on without copying
+    payload_view data(&ring_[wrap(begin)], end - begin);
+
+    // move on to the next message, in case callbacks block and end up
+    // parsing more data, but hold on to this one until they are done
+    if(!depth_) hold_ = head_;
+    head_ = next_;
 
-    return std::make_tuple(id, std::move(data));
+    ++depth_;
+    try { io_base::dispatch(id, data); }
+    catch(...) { --depth_; throw; }
+    --depth_;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
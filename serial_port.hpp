@@ -13,6 +13,10 @@
 #include "firmata/types.hpp"
 
 #include "asio_or_boost.hpp"
+#include <array>
+#include <cstddef>
+#include <map>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -63,15 +67,23 @@ public:
     void set(char_size);
 
     ////////////////////
-    // write message
+    // queue message for writing
     virtual void write(msg_id, const payload& = { }) override;
 
+    // block until all queued messages are written
+    virtual void flush() override;
+
     // install read callback
     virtual cid on_read(read_call) override;
+    virtual cid on_read(msg_id, read_call) override;
+    virtual cid on_read(msg_id first, msg_id last, read_call) override;
 
-    // remove read callback
+    // remove read (or timeout) callback
     virtual bool remove_call(cid) override;
 
+    // install timeout callback
+    virtual cid on_timeout(const msec&, timeout_call) override;
+
     // block until condition
     virtual bool wait_until(const condition&, const msec&) override;
 
@@ -80,14 +92,69 @@ private:
     asio::serial_port port_;
     asio::system_timer timer_;
 
-    std::vector<byte> overall_; // overall buffer
-    char one_[128]; // single read buffer
+    // timeout callback timers
+    std::map<cid, std::unique_ptr<asio::system_timer>> timers_;
+    unsigned timer_id_ = 0;
+
+    ////////////////////
+    // receive ring buffer
+    //
+    // data is read into the first half and mirrored into the second half,
+    // so that any message (up to ring_size long) is stored contiguously
+    //
+    static constexpr std::size_t ring_size = 4096; // must be power of 2
+    std::array<byte, 2 * ring_size> ring_;
+
+    // free-running ring positions:
+    // start of current message, next byte to parse and end of data
+    std::size_t head_ = 0, next_ = 0, tail_ = 0;
+
+    // start of outermost message being dispatched; its data is
+    // not overwritten, while callbacks block and read more data
+    std::size_t hold_ = 0;
+    unsigned depth_ = 0; // nested dispatches
+
+    // start of data that can't be overwritten
+    std::size_t used() const noexcept { return depth_ ? hold_ : head_; }
+
+    static constexpr std::size_t wrap(std::size_t n) noexcept { return n & (ring_size - 1); }
+
+    // read is pending (or was cancelled and its handler hasn't run yet)
+    bool reading_ = false;
 
     void sched_async();
     void async_read(const asio::error_code&, std::size_t);
 
-    // parse one message from overall_ buffer
-    std::tuple<msg_id, payload> parse_one();
+    ////////////////////
+    // outgoing messages are encoded into queue_ and sent in one go,
+    // while messages queued during the write are coalesced for the next one
+    std::vector<byte> queue_, sending_;
+    bool writing_ = false;
+
+    // value updates in queue_ that can be replaced
+    // under latest_wins policy: key, offset and size
+    using value = std::tuple<dword, std::size_t, std::size_t>;
+    using value_iterator = std::vector<value>::iterator;
+    std::vector<value> values_;
+
+    // replace queued value update with one at the end of queue_
+    void replace_value(value_iterator, std::size_t offset);
+
+    void sched_write();
+    void async_write(const asio::error_code&, std::size_t);
+
+    ////////////////////
+    // parser state (kept across reads)
+    enum { idle, standard, sysex_id, ext_id, sysex_data } state_ = idle;
+
+    msg_id id_; // current message id
+    std::size_t begin_; // start of current message data
+
+    // parse received data and dispatch complete messages
+    void parse();
+
+    // dispatch current message
+    void dispatch(std::size_t begin, std::size_t end);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
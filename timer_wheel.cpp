@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "firmata/timer_wheel.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+constexpr unsigned timer_wheel::bits;
+constexpr timer_wheel::tick timer_wheel::slots;
+constexpr timer_wheel::tick timer_wheel::mask;
+constexpr unsigned timer_wheel::levels;
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::arm(node& n, tick expiry) noexcept
+{
+    if(n.armed()) unlink(n);
+    else ++size_;
+
+    n.expiry_ = expiry;
+    place(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::cancel(node& n) noexcept
+{
+    if(n.armed())
+    {
+        unlink(n);
+        --size_;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::advance(tick to)
+{
+    for(; now_ <= to; )
+    {
+        // nothing to do; skip ahead
+        if(!size_) { now_ = to + 1; break; }
+
+        // cascade higher levels, when lower ones wrap around
+        auto index = now_ & mask;
+        if(!index && !cascade(1) && !cascade(2)) cascade(3);
+
+        // take nodes out of the slot, so that callbacks
+        // are free to arm and cancel any nodes
+        node* list = nullptr;
+        auto& head = slot(0, index);
+        if(head)
+        {
+            list = head;
+            list->pprev_ = &list;
+            head = nullptr;
+        }
+        ++now_;
+
+        while(list)
+        {
+            auto& n = *list;
+            unlink(n);
+            --size_;
+
+            n.expired();
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+timer_wheel::tick timer_wheel::next() const noexcept
+{
+    for(tick n = now_; n < now_ + slots; ++n)
+        if(slots_[n & mask]) return n;
+
+    return (now_ + mask) & ~mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::link(node*& head, node& n) noexcept
+{
+    n.next_ = head;
+    if(head) head->pprev_ = &n.next_;
+
+    head = &n;
+    n.pprev_ = &head;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::unlink(node& n) noexcept
+{
+    *n.pprev_ = n.next_;
+    if(n.next_) n.next_->pprev_ = n.pprev_;
+
+    n.pprev_ = nullptr;
+    n.next_ = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::place(node& n) noexcept
+{
+    auto expiry = n.expiry_;
+
+    // overdue nodes go into the next slot to be processed
+    if(expiry < now_) expiry = now_;
+
+    auto delta = expiry - now_;
+    if(delta < slots) link(slot(0, expiry), n);
+    else if(delta < (slots << bits)) link(slot(1, expiry >> bits), n);
+    else if(delta < (slots << 2 * bits)) link(slot(2, expiry >> 2 * bits), n);
+    else
+    {
+        // too far out; will be placed again, when cascaded
+        auto max = now_ + (slots << 3 * bits) - 1;
+        if(expiry > max) expiry = max;
+
+        link(slot(3, expiry >> 3 * bits), n);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+timer_wheel::tick timer_wheel::cascade(unsigned level) noexcept
+{
+    auto index = (now_ >> level * bits) & mask;
+
+    auto& head = slot(level, index);
+    node* list = head;
+    head = nullptr;
+
+    while(list)
+    {
+        auto& n = *list;
+        list = n.next_;
+
+        n.pprev_ = nullptr;
+        n.next_ = nullptr;
+        place(n);
+    }
+
+    return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef FIRMATA_TIMER_WHEEL_HPP
+#define FIRMATA_TIMER_WHEEL_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace firmata
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchical timer wheel
+//
+// Timers are intrusive nodes linked into 4 levels of 64 slots each,
+// where a level n slot covers 64^n ticks. Nodes are moved down a level
+// as their time comes closer. Arming and cancelling are O(1) and don't
+// allocate. The wheel only keeps count of ticks; it is up to the owner
+// to advance it.
+//
+class timer_wheel
+{
+public:
+    ////////////////////
+    using tick = std::uint64_t;
+
+    // timer node (derive from it)
+    class node
+    {
+    public:
+        node() noexcept = default;
+        virtual ~node() = default;
+
+        node(const node&) = delete;
+        node& operator=(const node&) = delete;
+
+        bool armed() const noexcept { return pprev_; }
+        auto expiry() const noexcept { return expiry_; }
+
+    protected:
+        // called when the timer expires
+        virtual void expired() = 0;
+
+    private:
+        node** pprev_ = nullptr; // previous node's next_ or slot head
+        node* next_ = nullptr;
+        tick expiry_ = 0;
+
+        friend class timer_wheel;
+    };
+
+    ////////////////////
+    explicit timer_wheel(tick now = 0) noexcept : now_(now) { slots_.fill(nullptr); }
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    ////////////////////
+    // next tick to be processed
+    auto now() const noexcept { return now_; }
+
+    // arm (or re-arm) node to expire at given tick
+    void arm(node&, tick expiry) noexcept;
+    // disarm node
+    void cancel(node&) noexcept;
+
+    // number of armed nodes
+    auto size() const noexcept { return size_; }
+    bool empty() const noexcept { return !size_; }
+
+    // process ticks up to and including given tick,
+    // calling expired() on nodes that are due
+    void advance(tick to);
+
+    // tick, at which the wheel needs to be advanced next: either the
+    // earliest expiry within the next 64 ticks, or the next cascade
+    tick next() const noexcept;
+
+private:
+    ////////////////////
+    static constexpr unsigned bits = 6;
+    static constexpr tick slots = tick(1) << bits, mask = slots - 1;
+    static constexpr unsigned levels = 4;
+
+    std::array<node*, slots * levels> slots_;
+    tick now_;
+    std::size_t size_ = 0;
+
+    node*& slot(unsigned level, tick n) noexcept { return slots_[level * slots + (n & mask)]; }
+
+    void link(node*&, node&) noexcept;
+    void unlink(node&) noexcept;
+
+    // put node into level and slot according to its expiry
+    void place(node&) noexcept;
+    // move nodes from slot of given level down;
+    // return slot index
+    tick cascade(unsigned level) noexcept;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
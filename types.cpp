@@ -13,16 +13,16 @@ namespace firmata
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-std::string to_string(payload::const_iterator begin, payload::const_iterator end)
+std::string to_string(payload_view::iterator begin, payload_view::iterator end)
 {
     std::string s;
-    for(auto ci = begin; ci < std::prev(end); ++ci)
-        s += char(*ci + (*++ci << 7));
+    for(auto ci = begin; ci < std::prev(end); ci += 2)
+        s += char(ci[0] + (ci[1] << 7));
     return s;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-int to_value(payload::const_iterator begin, payload::const_iterator end)
+int to_value(payload_view::iterator begin, payload_view::iterator end)
 {
     // TODO: check for overflow
     int value = 0;
@@ -10,6 +10,7 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -35,6 +36,7 @@ using res = bits;
 
 // time
 using msec = std::chrono::milliseconds;
+using time_point = std::chrono::steady_clock::time_point;
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace literals
@@ -132,6 +134,8 @@ enum msg_id : dword
     version                 = 0xf9,
     reset                   = 0xff,
 
+    encoder_data            = sysex(0x61),
+
     analog_mapping_query    = sysex(0x69),
     analog_mapping_response = sysex(0x6a),
 
@@ -145,6 +149,10 @@ enum msg_id : dword
 
     string_data             = sysex(0x71),
 
+    i2c_request             = sysex(0x76),
+    i2c_reply               = sysex(0x77),
+    i2c_config              = sysex(0x78),
+
     firmware_query          = sysex(0x79),
     firmware_response       = firmware_query,
 
@@ -166,13 +174,46 @@ constexpr auto analog_count = analog_value_end - analog_value_base;
 // message data
 using payload = std::vector<byte>;
 
+// non-owning view of message data
+class payload_view
+{
+public:
+    ////////////////////
+    using value_type = byte;
+    using iterator = const byte*;
+    using const_iterator = const byte*;
+
+    constexpr payload_view() noexcept = default;
+    constexpr payload_view(const byte* data, std::size_t size) noexcept :
+        data_(data), size_(size)
+    { }
+    payload_view(const payload& data) noexcept :
+        payload_view(data.data(), data.size())
+    { }
+
+    ////////////////////
+    constexpr auto begin() const noexcept { return data_; }
+    constexpr auto end() const noexcept { return data_ + size_; }
+
+    constexpr auto data() const noexcept { return data_; }
+    constexpr auto size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return !size_; }
+
+    constexpr auto operator[](std::size_t n) const noexcept { return data_[n]; }
+
+private:
+    ////////////////////
+    const byte* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
 // convert 7-bit message data to string
-std::string to_string(payload::const_iterator begin, payload::const_iterator end);
-inline auto to_string(const payload& data) { return to_string(data.begin(), data.end()); }
+std::string to_string(payload_view::iterator begin, payload_view::iterator end);
+inline auto to_string(payload_view data) { return to_string(data.begin(), data.end()); }
 
 // convert 7-bit message data to value
-int to_value(payload::const_iterator begin, payload::const_iterator end);
-inline auto to_value(const payload& data) { return to_value(data.begin(), data.end()); }
+int to_value(payload_view::iterator begin, payload_view::iterator end);
+inline auto to_value(payload_view data) { return to_value(data.begin(), data.end()); }
 
 // convert string to 7-bit message data
 payload to_data(const std::string&);